@@ -0,0 +1,64 @@
+#pragma once
+
+#include "bench_tools.hpp"
+
+// compares the contraction engines of einsum with torch::einsum on the same
+// CPU shapes, the pattern is prepared once so only the contraction is measured
+
+class EinsumBenchmark : public Benchmark
+{
+public:
+	EinsumBenchmark()
+		: Benchmark("Einsum engines")
+	{}
+
+	struct Case
+	{
+		std::string pattern;
+		std::string equation;
+		std::vector<std::vector<int64_t>> shapes;
+	};
+
+	const std::vector<Case> cases =
+	{
+		{ "b i j, b j k -> b i k",          "bij,bjk->bik",       { { 64, 128, 128 }, { 64, 128, 128 } } },
+		{ "i j, k j -> k i",                "ij,kj->ki",          { { 512, 512 }, { 512, 512 } } },
+		{ "b h n d, b h m d -> b h n m",    "bhnd,bhmd->bhnm",    { { 8, 12, 197, 64 }, { 8, 12, 197, 64 } } },
+		{ "b h n m, b h m d -> b n h d",    "bhnm,bhmd->bnhd",    { { 8, 12, 197, 197 }, { 8, 12, 197, 64 } } },
+		{ "a b c, c b d -> d a",            "abc,cbd->da",        { { 64, 32, 48 }, { 48, 32, 64 } } },
+		{ "a b, b c, c d -> a d",           "ab,bc,cd->ad",       { { 256, 64 }, { 64, 512 }, { 512, 32 } } },
+	};
+
+	void bench_engines()
+	{
+		for (auto&& [pattern, equation, shapes] : cases)
+		{
+			std::vector<torch::Tensor> tensors;
+			for (auto&& shape : shapes)
+				tensors.push_back(torch::randn(shape));
+
+			auto [backend, _] = get_backend(tensors.front());
+			auto recipe = _prepare_einsum_recipe(pattern);
+
+			measure(equation + " (torch::einsum)", [&]()
+			{
+				return torch::einsum(equation, tensors).contiguous();
+			}, 50);
+
+			for (auto engine : _einsum_engines)
+			{
+				set_einsum_engine(engine);
+				measure(equation + " (" + engine + ")", [&]()
+				{
+					return _apply_einsum_recipe(backend, recipe, tensors, {}).contiguous();
+				}, 50);
+			}
+			set_einsum_engine("backend");
+		}
+	}
+
+	void bench_list() final
+	{
+		bench_engines();
+	}
+};
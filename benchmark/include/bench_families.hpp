@@ -0,0 +1,64 @@
+#pragma once
+
+#include "bench_tools.hpp"
+
+// compares the dedicated path of each kernel family with the generic one,
+// the generic path is forced by resetting the family tag of the recipe
+
+class FamiliesBenchmark : public Benchmark
+{
+public:
+	FamiliesBenchmark()
+		: Benchmark("Kernel families")
+	{}
+
+	struct Case
+	{
+		std::string pattern;
+		std::vector<int64_t> shape;
+		AxesLengths axes_lengths;
+	};
+
+	const std::vector<Case> cases =
+	{
+		{ "b c h w -> b c h w",                     { 32, 64, 28, 28 }, {} },
+		{ "b c h w -> b (c h w)",                   { 32, 64, 28, 28 }, {} },
+		{ "h w -> w h",                             { 1024, 1024 },     {} },
+		{ "b h w -> b w h",                         { 32, 256, 256 },   {} },
+		{ "b c h w -> b h w c",                     { 32, 64, 28, 28 }, {} },
+		{ "b n (h d) -> b h n d",                   { 32, 197, 768 },   { { "h", 12 } } },
+		{ "b h n d -> b n (h d)",                   { 32, 12, 197, 64 }, {} },
+		{ "b (c h2 w2) h w -> b c (h h2) (w w2)",   { 32, 64, 28, 28 }, { { "h2", 2 }, { "w2", 2 } } },
+		{ "b c (h h2) (w w2) -> b (c h2 w2) h w",   { 32, 16, 56, 56 }, { { "h2", 2 }, { "w2", 2 } } },
+		{ "b c (h p1) (w p2) -> b (h w) (p1 p2 c)", { 32, 3, 224, 224 }, { { "p1", 16 }, { "p2", 16 } } },
+		{ "b (h w) (p1 p2 c) -> b c (h p1) (w p2)", { 32, 196, 768 },   { { "p1", 16 }, { "p2", 16 }, { "h", 14 } } },
+	};
+
+	void bench_families()
+	{
+		for (auto&& [pattern, shape, axes_lengths] : cases)
+		{
+			auto x = torch::randn(shape);
+			auto [backend, _] = get_backend(x);
+
+			auto recipe = *_prepare_transformation_recipe(pattern, "rearrange", axes_lengths, shape.size());
+			auto generic = recipe;
+				 generic.family = KernelFamily::generic;
+
+			// contiguous() makes both paths pay for the final memory layout
+			measure(print(recipe.family) + " (routed)", [&]() 
+			{
+				return _apply_recipe(backend, recipe, x, "rearrange", axes_lengths).contiguous();
+			}, 100);
+			measure(print(recipe.family) + " (generic)", [&]()
+			{
+				return _apply_recipe(backend, generic, x, "rearrange", axes_lengths).contiguous();
+			}, 100);
+		}
+	}
+
+	void bench_list() final
+	{
+		bench_families();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "bench_tools.hpp"
+
+#include <packing.hpp>
+
+// packs and unpacks many parameter-like tensors, with sequential and parallel copies
+
+class PackingBenchmark : public Benchmark
+{
+public:
+	PackingBenchmark()
+		: Benchmark("Packing")
+	{}
+
+	void bench_parallel()
+	{
+		std::vector<torch::Tensor> small, large;
+		for (auto i : iters::range(512))
+			small.push_back(torch::randn({ i % 13 + 1, 64 }));
+		for (auto i : iters::range(8))
+			large.push_back(torch::randn({ 1024 + i, 1024 }));
+
+		const std::vector<std::tuple<std::string, std::vector<torch::Tensor>>> cases = { { "512 small", small }, { "8 large", large } };
+		for (auto&& [label, tensors] : cases)
+		{
+			auto&& [packed, ps] = pack(tensors, "* d");
+			auto plan = PackPlan("* d", ps);
+
+			for (auto parallel : { false, true })
+			{
+				set_pack_parallel(parallel);
+				auto suffix = std::string(parallel ? " (parallel)" : " (sequential)");
+				measure(label + " pack" + suffix, [&]() { return pack(tensors, "* d"); }, 50);
+				measure(label + " unpack_contiguous" + suffix, [&]() { return unpack_contiguous(packed, plan); }, 50);
+			}
+			set_pack_parallel(false);
+		}
+	}
+
+	void bench_list() final
+	{
+		bench_parallel();
+	}
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "bench_tools.hpp"
+
+#include <atomic>
+#include <thread>
+
+// cold-miss recipe builds from several threads at once: every pattern is new, so each
+// call parses it and prepares its recipe. Parsing shares no mutable state, the time of
+// a round should stay flat as threads are added (build with -fsanitize=thread to check races)
+
+class ParsingBenchmark : public Benchmark
+{
+public:
+	ParsingBenchmark()
+		: Benchmark("Parsing")
+	{}
+
+	void bench_concurrent_builds()
+	{
+		std::atomic<int64_t> counter{ 0 };
+
+		auto build = [&counter]()
+		{
+			auto n = std::to_string(counter++);
+			auto h = "height" + n, w = "width" + n;
+			_prepare_transformation_recipe(format("b (h2 {}) {} -> b {} (h2 {})", h, w, h, w), "rearrange", { { "h2", 2 } }, 3);
+			_prepare_transformation_recipe(format("b {} {} -> b ({} 2) {}", h, w, h, w), "repeat", {}, 3);
+			_prepare_transformation_recipe(format("b {} {} -> b {}", h, w, w), "sum", {}, 3);
+		};
+
+		const int builds_per_thread = 2000;
+		for (auto n_threads : { 1, 2, 4, 8 })
+		{
+			auto label = format("{} threads, {} patterns each", print(n_threads), print(builds_per_thread));
+			measure(label, [&]()
+			{
+				std::vector<std::thread> threads;
+				for (auto _ : iters::range(n_threads))
+					threads.emplace_back([&]()
+					{
+						for (auto _ : iters::range(builds_per_thread))
+							build();
+					});
+				for (auto&& thread : threads)
+					thread.join();
+			}, 10);
+		}
+	}
+
+	void bench_list() final
+	{
+		bench_concurrent_builds();
+	}
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <iomanip>
+
+#include <einops.hpp>
+using namespace einops;
+using namespace einops::backends;
+using namespace einops::implementation;
+
+class Benchmark
+{
+	using clock = std::chrono::steady_clock;
+
+public:
+	Benchmark(std::string const& name)
+		: name(name)
+	{}
+
+	virtual void bench_list() = 0;
+
+	void run()
+	{
+		std::cout << single_line << std::endl;
+		std::cout << "Benchmark '" << name << "'" << std::endl;
+		std::cout << single_line << std::endl;
+		bench_list();
+	}
+
+	// returns the mean duration of one call in microseconds, after a short warmup
+	template <typename Function>
+	double measure(std::string const& label, Function&& function, int iterations = 1000)
+	{
+		for (auto _ : iters::range(std::max(1, iterations / 10)))
+			function();
+
+		auto start = clock::now();
+		for (auto _ : iters::range(iterations))
+			function();
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+		auto mean = double(elapsed) / double(iterations) / 1000.0;
+		std::cout << " " << std::left << std::setw(56) << label << std::right << std::setw(12) 
+				  << std::fixed << std::setprecision(3) << mean << " us" << std::endl;
+		return mean;
+	}
+
+private:
+	std::string name;
+
+	const int ncols { 80 };
+	const std::string single_line = std::string(ncols, '-');
+};
\ No newline at end of file
@@ -0,0 +1,21 @@
+#include "bench_families.hpp"
+#include "bench_einsum.hpp"
+#include "bench_packing.hpp"
+#include "bench_parsing.hpp"
+
+int main()
+{
+    try
+    {
+        FamiliesBenchmark().run();
+        EinsumBenchmark().run();
+        PackingBenchmark().run();
+        ParsingBenchmark().run();
+    }
+    catch (std::exception const& e)
+    {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <einops.hpp>
+#include <parallel.hpp>
+
+// rearrange, reduce, repeat and einsum returning futures, computed on the thread pool of
+// rearrange_many and reduce_many, recipes included. Calls on the same tensor run in the
+// order they were issued, one at a time, calls on different tensors run concurrently.
+
+namespace einops {
+namespace implementation {
+
+// queues of tasks by key, a key has at most one task on the pool: the next one is
+// submitted by the task before it when it is done
+class AsyncStrands
+{
+public:
+	using Task = std::function<void()>;
+
+	void submit(ThreadPool& pool, void const* key, Task task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto&& queue = _queues[key];
+			queue.push_back(std::move(task));
+			if (queue.size() > 1)
+				return;
+		}
+		pool.submit([this, &pool, key]() { run(pool, key); });
+	}
+
+private:
+	std::mutex _mutex;
+	std::unordered_map<void const*, std::deque<Task>> _queues;
+
+	void run(ThreadPool& pool, void const* key)
+	{
+		Task task;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			task = _queues[key].front();
+		}
+
+		// packaged tasks keep their exceptions for the futures
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto&& queue = _queues[key];
+			queue.pop_front();
+			if (queue.empty())
+			{
+				_queues.erase(key);
+				return;
+			}
+		}
+		pool.submit([this, &pool, key]() { run(pool, key); });
+	}
+};
+
+inline auto _async_strands() -> AsyncStrands&
+{
+	static AsyncStrands strands;
+	return strands;
+}
+
+template <typename Tensor>
+inline auto _async_operand(Tensor const& tensor) -> Tensor const&
+{
+	return tensor;
+}
+
+template <typename Tensor>
+inline auto _async_operand(Constant<Tensor> const& constant) -> Tensor const&
+{
+	return constant.tensor;
+}
+
+// queued after the other calls on the same operand, run under the thread local state
+// (grad and inference modes...) of the calling thread
+template <typename Arg, typename Function>
+inline auto _submit_async(Arg const& arg, Function&& function) -> std::future<decltype(function())>
+{
+	using Result = decltype(function());
+	auto&& operand = _async_operand(arg);
+	auto backend = std::get<0>(backends::get_backend(operand));
+	auto key = backend.identity(operand);
+	auto state = backend.thread_state();
+
+	auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+	auto future = task->get_future();
+	_async_strands().submit(_get_parallel_pool(), key, [task, state]()
+	{
+		typename decltype(backend)::ThreadStateGuard guard (state);
+		(*task)();
+	});
+	return future;
+}
+
+} // namespace implementation
+
+/// @brief reduce() computed on the thread pool, see set_parallel_threads.
+/// Calls on the same tensor are computed in the order they were made.
+/// @param tensor tensor of any supported library
+/// @param pattern string, reduction pattern
+/// @param reduction one of available reductions ('min', 'max', 'sum', 'mean', 'prod'), case-sensitive
+/// @param axes_lengths any additional specifications for dimensions
+/// @return future of the tensor reduce() returns, holding its exception when it throws.
+template <typename Tensor, typename... Args>
+auto reduce_async(Tensor const& tensor, std::string const& pattern, std::string const& reduction, Args... axes_lengths)
+{
+	return implementation::_submit_async(tensor, [=]()
+	{
+		return reduce(tensor, pattern, reduction, axes_lengths...);
+	});
+}
+
+/// @brief rearrange() computed on the thread pool, see reduce_async.
+/// @param tensor tensor of any supported library
+/// @param pattern string, rearrangement pattern
+/// @param axes_lengths any additional specifications for dimensions
+/// @return future of the tensor rearrange() returns.
+template <typename Tensor, typename... Args>
+auto rearrange_async(Tensor const& tensor, std::string const& pattern, Args... axes_lengths)
+{
+	return reduce_async(tensor, pattern, "rearrange", axes_lengths...);
+}
+
+/// @brief repeat() computed on the thread pool, see reduce_async.
+/// @param tensor tensor of any supported library
+/// @param pattern string, rearrangement pattern
+/// @param axes_lengths any additional specifications for dimensions
+/// @return future of the tensor repeat() returns.
+template <typename Tensor, typename... Args>
+auto repeat_async(Tensor const& tensor, std::string const& pattern, Args... axes_lengths)
+{
+	return reduce_async(tensor, pattern, "repeat", axes_lengths...);
+}
+
+/// @brief einsum() computed on the thread pool, ordered with the other calls on its first operand.
+/// @param pattern string in einops-style.
+/// @param tensor one or more tensor where is type is supported by the backends,
+/// followed by any additional specifications for dimensions
+/// @return future of the tensor einsum() returns.
+template <typename Arg, typename... Args>
+auto einsum_async(std::string const& pattern, Arg const& arg, Args... args)
+{
+	return implementation::_submit_async(arg, [=]()
+	{
+		return einsum(pattern, arg, args...);
+	});
+}
+
+} // namespace einops
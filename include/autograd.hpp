@@ -0,0 +1,151 @@
+#pragma once
+
+#ifdef EINOPS_TORCH_BACKEND
+
+#include <einops.hpp>
+#include <torch/torch.h>
+
+// Rearrange, repeat, sum and mean reductions as a single autograd node. Forward applies
+// the cooked recipe, backward undoes it at once: the final reshape is reverted, added axes
+// are summed (tile-sum of repeat), reduced axes are broadcast back (divided for mean),
+// then the permutation and the initial reshape are reverted. Only shapes are saved.
+
+namespace einops {
+namespace implementation {
+
+inline auto _has_recipe_gradient(Reduction const& reduction) -> bool
+{
+	return reduction == "rearrange" || reduction == "repeat" || reduction == "sum" || reduction == "mean";
+}
+
+class RecipeFunction : public torch::autograd::Function<RecipeFunction>
+{
+public:
+	static auto forward(torch::autograd::AutogradContext* ctx, torch::Tensor x, TransformRecipe const& recipe, CookedRecipe const& cooked, Reduction const& reduction) -> torch::Tensor
+	{
+		auto&& [init_shapes, axes_reordering, reduced_axes, added_axes, final_shapes, n_axes_w_added] = cooked;
+
+		auto input_shape = x.sizes().vec();
+		auto permuted_shape = init_shapes.value_or(input_shape);
+		if (axes_reordering.has_value())
+		{
+			auto shape = permuted_shape;
+			for (auto&& [i, axis] : iters::enumerate(axes_reordering.value()))
+				permuted_shape[i] = shape[axis];
+		}
+
+		// shape before the final reshape: kept axes with the added ones inserted
+		Shape expanded_shape (permuted_shape.begin(), permuted_shape.end() - reduced_axes.size());
+		Axes added_positions;
+		for (auto&& [position, length] : added_axes)
+		{
+			expanded_shape.insert(expanded_shape.begin() + position, length);
+			added_positions.push_back(position);
+		}
+
+		ctx->saved_data["input_shape"] = input_shape;
+		ctx->saved_data["permutation"] = axes_reordering.value_or(Axes());
+		ctx->saved_data["permuted_shape"] = permuted_shape;
+		ctx->saved_data["n_reduced_axes"] = int64_t(reduced_axes.size());
+		ctx->saved_data["added_axes"] = added_positions;
+		ctx->saved_data["expanded_shape"] = expanded_shape;
+		ctx->saved_data["reduction"] = reduction;
+
+		auto backend = backends::TorchBackend();
+		return _apply_cooked_recipe(backend, recipe, cooked, x, reduction);
+	}
+
+	static auto backward(torch::autograd::AutogradContext* ctx, torch::autograd::variable_list grad_outputs) -> torch::autograd::variable_list
+	{
+		auto input_shape = ctx->saved_data["input_shape"].toIntVector();
+		auto permutation = ctx->saved_data["permutation"].toIntVector();
+		auto permuted_shape = ctx->saved_data["permuted_shape"].toIntVector();
+		auto n_reduced_axes = ctx->saved_data["n_reduced_axes"].toInt();
+		auto added_axes = ctx->saved_data["added_axes"].toIntVector();
+		auto expanded_shape = ctx->saved_data["expanded_shape"].toIntVector();
+		auto reduction = ctx->saved_data["reduction"].toStringRef();
+
+		auto grad = grad_outputs[0].reshape(expanded_shape);
+		if (!added_axes.empty())
+			grad = grad.sum(added_axes);
+
+		if (n_reduced_axes > 0)
+		{
+			auto kept_shape = Shape(permuted_shape.begin(), permuted_shape.end() - n_reduced_axes);
+			kept_shape.resize(permuted_shape.size(), 1);
+			grad = grad.reshape(kept_shape).expand(permuted_shape);
+			if (reduction == "mean")
+				grad = grad / prod(Shape(permuted_shape.end() - n_reduced_axes, permuted_shape.end()));
+		}
+
+		if (!permutation.empty())
+		{
+			Axes inverse (permutation.size());
+			for (auto&& [i, axis] : iters::enumerate(permutation))
+				inverse[axis] = i;
+			grad = grad.permute(inverse);
+		}
+
+		return { grad.reshape(input_shape), torch::Tensor(), torch::Tensor(), torch::Tensor() };
+	}
+};
+
+// the recipe as one autograd node when it is differentiated, plain backend calls otherwise
+inline auto _apply_cooked_recipe_with_grad(TransformRecipe const& recipe, CookedRecipe const& cooked, torch::Tensor const& x, Reduction const& reduction) -> torch::Tensor
+{
+	if (at::GradMode::is_enabled() && x.requires_grad() && _has_recipe_gradient(reduction))
+		return RecipeFunction::apply(x, recipe, cooked, reduction);
+
+	auto backend = backends::TorchBackend();
+	return _apply_cooked_recipe(backend, recipe, cooked, x, reduction);
+}
+
+} // namespace implementation
+
+namespace autograd {
+
+/// @brief reduce() recorded as a single autograd node, its backward reverts the recipe at once.
+///		Min, max and prod reductions keep the autograd nodes of every step.
+/// @param tensor torch tensor
+/// @param pattern string, reduction pattern
+/// @param reduction one of available reductions ('min', 'max', 'sum', 'mean', 'prod'), case-sensitive
+/// @param axes_lengths any additional specifications for dimensions
+/// @return tensor of the same type as input.
+template <typename... Args>
+auto reduce(torch::Tensor const& tensor, std::string const& pattern, std::string const& reduction, Args... axes_lengths) -> torch::Tensor
+{
+	using namespace implementation;
+
+	auto shape = tensor.sizes().vec();
+	auto hashable_axes_lengths = _hashable_axes_lengths(axes_lengths...);
+	auto recipe = _prepare_transformation_recipe(pattern, reduction, hashable_axes_lengths, shape.size());
+	auto cooked = _reconstruct_from_shape(*recipe, shape, hashable_axes_lengths);
+	return _apply_cooked_recipe_with_grad(*recipe, *cooked, tensor, reduction);
+}
+
+/// @brief rearrange() recorded as a single autograd node.
+/// @param tensor torch tensor
+/// @param pattern string, rearrangement pattern
+/// @param axes_lengths any additional specifications for dimensions
+/// @return tensor of the same type as input.
+template <typename... Args>
+auto rearrange(torch::Tensor const& tensor, std::string const& pattern, Args... axes_lengths) -> torch::Tensor
+{
+	return reduce(tensor, pattern, "rearrange", axes_lengths...);
+}
+
+/// @brief repeat() recorded as a single autograd node, its backward sums over the repeats.
+/// @param tensor torch tensor
+/// @param pattern string, rearrangement pattern
+/// @param axes_lengths any additional specifications for dimensions
+/// @return tensor of the same type as input.
+template <typename... Args>
+auto repeat(torch::Tensor const& tensor, std::string const& pattern, Args... axes_lengths) -> torch::Tensor
+{
+	return reduce(tensor, pattern, "repeat", axes_lengths...);
+}
+
+} // namespace autograd
+} // namespace einops
+
+#endif // EINOPS_TORCH_BACKEND
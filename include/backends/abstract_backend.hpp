@@ -12,6 +12,11 @@ public:
 	virtual ~AbstractBackend() = default;
 
 	virtual inline bool is_float_type(Tensor const& x) const = 0;
+	virtual inline std::string type_name(Tensor const& x) const = 0;
+	virtual inline std::string device_name(Tensor const& x) const = 0;
+	virtual inline const void* identity(Tensor const& x) const = 0;
+	virtual inline int64_t version(Tensor const& x) const = 0;
+	virtual inline bool records_gradient(Tensor const& x) const = 0;
 
 	virtual inline std::vector<int64_t> shape(Tensor const& x) = 0;
 	virtual inline Tensor reshape(Tensor const& x, std::vector<int64_t> const& shape) = 0;
@@ -19,14 +24,26 @@ public:
 	virtual inline Tensor add_axis(Tensor const& x, int64_t new_position) = 0;
 	virtual inline Tensor add_axes(Tensor const& x, int64_t n_axes, std::map<int64_t, int64_t> const& pos2len) = 0;
 	virtual inline Tensor stack_on_zeroth_dimension(std::vector<Tensor> const& list) = 0;
+	virtual inline std::vector<Tensor> unstack_on_zeroth_dimension(Tensor const& x) = 0;
 
 	virtual inline Tensor arange(int64_t start, int64_t stop) = 0;
+	virtual inline Tensor empty(Tensor const& like, std::vector<int64_t> const& shape) = 0;
+	virtual inline Tensor indices(std::vector<int64_t> const& values, Tensor const& like) = 0;
+	virtual inline std::vector<int64_t> values(Tensor const& x) = 0;
+	virtual inline Tensor repeat_interleave(Tensor const& x, Tensor const& repeats, int64_t output_size) = 0;
 	
 	virtual inline Tensor reduce(Tensor const& x, std::string const& operation, std::vector<int64_t> const& reduced_axes) = 0;
 	virtual inline Tensor transpose(Tensor const& x, std::vector<int64_t> const& axes) = 0;
 	virtual inline Tensor tile(Tensor const& x, std::vector<int64_t> const& repeats) = 0;
 	virtual inline Tensor concat(std::vector<Tensor> const& tensors, int64_t axis) = 0;
+	virtual inline std::vector<Tensor> split(Tensor const& x, std::vector<int64_t> const& sizes, int64_t axis) = 0;
+	virtual inline Tensor narrow(Tensor const& x, int64_t axis, int64_t start, int64_t length) = 0;
+	virtual inline void copy_into(Tensor const& destination, Tensor const& source) = 0;
+	virtual inline Tensor pixel_shuffle(Tensor const& x, int64_t upscale_factor) = 0;
+	virtual inline Tensor pixel_unshuffle(Tensor const& x, int64_t downscale_factor) = 0;
 	virtual inline Tensor einsum(std::string const& pattern, std::vector<Tensor> const& tensors) = 0;
+	virtual inline Tensor matmul(Tensor const& x, Tensor const& y) = 0;
+	virtual inline Tensor tensordot(Tensor const& x, Tensor const& y, std::vector<int64_t> const& x_axes, std::vector<int64_t> const& y_axes) = 0;
 };
 
 } // namespace backends
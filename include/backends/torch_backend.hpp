@@ -24,6 +24,44 @@ public:
 				x.dtype() == torch::kBFloat16) ? true : false;
 	}
 
+	inline std::string type_name(Tensor const& x) const final
+	{
+		return std::string(x.dtype().name());
+	}
+
+	inline std::string device_name(Tensor const& x) const final
+	{
+		return x.device().str();
+	}
+
+	// the tensor implementation, shared by every handle on the same tensor
+	inline const void* identity(Tensor const& x) const final
+	{
+		return x.unsafeGetTensorImpl();
+	}
+
+	// bumped by every in-place modification
+	inline int64_t version(Tensor const& x) const final
+	{
+		return x._version();
+	}
+
+	// operations on x are recorded by autograd
+	inline bool records_gradient(Tensor const& x) const final
+	{
+		return torch::GradMode::is_enabled() && x.requires_grad();
+	}
+
+	// grad mode, inference mode and the other thread local settings of the calling
+	// thread, for work handed to other threads to run under a ThreadStateGuard
+	using ThreadState = at::ThreadLocalState;
+	using ThreadStateGuard = at::ThreadLocalStateGuard;
+
+	inline ThreadState thread_state() const
+	{
+		return ThreadState();
+	}
+
 	inline std::vector<int64_t> shape(Tensor const& x) final
 	{
 		return x.sizes().vec();
@@ -61,12 +99,40 @@ public:
 		return torch::stack(tensors);
 	}
 
+	inline std::vector<Tensor> unstack_on_zeroth_dimension(Tensor const& x) final
+	{
+		return x.unbind(0);
+	}
+
 	template <typename Type>
 	inline Tensor arange(Type start, Type stop)
 	{
 		return torch::arange(start, stop);
 	}
 
+	// uninitialized tensor of the type and device of like
+	inline Tensor empty(Tensor const& like, std::vector<int64_t> const& shape) final
+	{
+		return torch::empty(shape, like.options());
+	}
+
+	// int32 tensor on the device of like, as expected by variable length attention kernels
+	inline Tensor indices(std::vector<int64_t> const& values, Tensor const& like) final
+	{
+		return torch::tensor(values, torch::TensorOptions().dtype(torch::kInt64)).to(like.device(), torch::kInt32);
+	}
+
+	inline std::vector<int64_t> values(Tensor const& x) final
+	{
+		auto host = x.to(torch::kCPU, torch::kInt64).contiguous();
+		return std::vector<int64_t>(host.data_ptr<int64_t>(), host.data_ptr<int64_t>() + host.numel());
+	}
+
+	inline Tensor repeat_interleave(Tensor const& x, Tensor const& repeats, int64_t output_size) final
+	{
+		return torch::repeat_interleave(x, repeats, 0, output_size);
+	}
+
 	inline Tensor arange(int64_t start, int64_t stop) final
 	{
 		return torch::arange(start, stop, c10::TensorOptions().dtype(torch::kInt64));
@@ -123,10 +189,45 @@ public:
 		return torch::cat(tensors, axis);
 	}
 
+	inline std::vector<Tensor> split(Tensor const& x, std::vector<int64_t> const& sizes, int64_t axis) final
+	{
+		return x.split_with_sizes(sizes, axis);
+	}
+
+	inline Tensor narrow(Tensor const& x, int64_t axis, int64_t start, int64_t length) final
+	{
+		return x.narrow(axis, start, length);
+	}
+
+	inline void copy_into(Tensor const& destination, Tensor const& source) final
+	{
+		destination.copy_(source);
+	}
+
+	inline Tensor pixel_shuffle(Tensor const& x, int64_t upscale_factor) final
+	{
+		return torch::pixel_shuffle(x, upscale_factor);
+	}
+
+	inline Tensor pixel_unshuffle(Tensor const& x, int64_t downscale_factor) final
+	{
+		return torch::pixel_unshuffle(x, downscale_factor);
+	}
+
 	inline Tensor einsum(std::string const& pattern, std::vector<Tensor> const& tensors) final
 	{
 		return torch::einsum(pattern, tensors);
 	}
+
+	inline Tensor matmul(Tensor const& x, Tensor const& y) final
+	{
+		return torch::matmul(x, y);
+	}
+
+	inline Tensor tensordot(Tensor const& x, Tensor const& y, std::vector<int64_t> const& x_axes, std::vector<int64_t> const& y_axes) final
+	{
+		return torch::tensordot(x, y, x_axes, y_axes);
+	}
 };
 
 template <typename Tensor>
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <parsing.hpp>
+
+namespace einops {
+namespace implementation {
+
+// One pairwise (or final multi-operand) contraction of a path, following the
+// opt_einsum convention: the operands are positions in the current list of
+// operands, they are removed from it and the result is appended at the end.
+
+struct ContractionStep
+{
+	Axes operands;
+	std::string equation;
+};
+
+using ContractionPath = std::vector<ContractionStep>;
+
+class ContractionPathOptimizer
+{
+public:
+	// exhaustive search is affordable up to this number of operands (180 orders for 5)
+	static constexpr size_t optimal_max_operands = 5;
+
+	ContractionPathOptimizer(std::vector<std::string> const& inputs,
+							 std::string const& output,
+							 std::map<char, int64_t> const& sizes,
+							 std::optional<int64_t> const& memory_limit = std::nullopt)
+		: _inputs(inputs)
+		, _output(output)
+		, _sizes(sizes)
+		, _memory_limit(memory_limit)
+	{}
+
+	auto optimize() const -> ContractionPath
+	{
+		if (_inputs.size() <= optimal_max_operands)
+		{
+			auto path = optimal();
+			if (!path.empty())
+				return path;
+		}
+		return greedy();
+	}
+
+	// pick at each step the pair that shrinks the operands the most
+	auto greedy() const -> ContractionPath
+	{
+		ContractionPath path;
+		auto operands = _inputs;
+
+		while (operands.size() > 1)
+		{
+			std::optional<std::tuple<bool, int64_t, int64_t>> best_score;
+			Axes best_pair;
+
+			for (auto i : iters::range<Axis>(operands.size()))
+			{
+				for (auto j : iters::range<Axis>(i + 1, operands.size()))
+				{
+					auto result = result_of(operands, { i, j });
+					if (!fits(operands, result))
+						continue;
+
+					auto shares = std::any_of(operands[i].begin(), operands[i].end(), [&](char c) { return contains(operands[j], c); });
+					auto removed = size_of(result) - size_of(operands[i]) - size_of(operands[j]);
+					auto score = std::make_tuple(!shares, removed, cost_of(operands, { i, j }));
+
+					if (!best_score.has_value() || score < best_score.value())
+					{
+						best_score = score;
+						best_pair = { i, j };
+					}
+				}
+			}
+
+			// nothing fits within the memory limit, contract the remaining operands at once
+			if (!best_score.has_value())
+				best_pair = iters::range<Axis>(operands.size()).vec();
+
+			path.push_back(contract(operands, best_pair));
+		}
+
+		return path;
+	}
+
+	// depth-first search over all pairwise orders, returns an empty path if
+	// no order respects the memory limit
+	auto optimal() const -> ContractionPath
+	{
+		ContractionPath best_path;
+		std::optional<int64_t> best_cost;
+
+		ContractionPath path;
+		std::function<void(std::vector<std::string> const&, int64_t)> search;
+		search = [&](std::vector<std::string> const& operands, int64_t cost)
+		{
+			if (best_cost.has_value() && cost >= best_cost.value())
+				return;
+
+			if (operands.size() == 1)
+			{
+				best_cost = cost;
+				best_path = path;
+				return;
+			}
+
+			for (auto i : iters::range<Axis>(operands.size()))
+			{
+				for (auto j : iters::range<Axis>(i + 1, operands.size()))
+				{
+					auto remaining = operands;
+					auto step_cost = cost_of(remaining, { i, j });
+					if (!fits(remaining, result_of(remaining, { i, j })))
+						continue;
+
+					path.push_back(contract(remaining, { i, j }));
+					search(remaining, cost + step_cost);
+					path.pop_back();
+				}
+			}
+		};
+
+		search(_inputs, 0);
+
+		return best_path;
+	}
+
+private:
+	std::vector<std::string> _inputs;
+	std::string _output;
+	std::map<char, int64_t> _sizes;
+	std::optional<int64_t> _memory_limit;
+
+	auto size_of(std::string const& indices) const -> int64_t
+	{
+		int64_t size = 1;
+		for (auto c : indices)
+			size *= _sizes.at(c);
+		return size;
+	}
+
+	// number of multiply-adds, i.e. product over all indices of the operands
+	auto cost_of(std::vector<std::string> const& operands, Axes const& picked) const -> int64_t
+	{
+		std::string indices;
+		for (auto i : picked)
+			for (auto c : operands[i])
+				if (!contains(indices, c))
+					indices += c;
+		return size_of(indices);
+	}
+
+	// the indices of the picked operands still needed by the others or by the output,
+	// the last contraction of a path always produces the output itself
+	auto result_of(std::vector<std::string> const& operands, Axes const& picked) const -> std::string
+	{
+		if (picked.size() == operands.size())
+			return _output;
+
+		std::string needed = _output;
+		for (auto&& [i, operand] : iters::enumerate(operands))
+			if (!contains(picked, Axis(i)))
+				needed += operand;
+
+		std::string result;
+		for (auto i : picked)
+			for (auto c : operands[i])
+				if (contains(needed, c) && !contains(result, c))
+					result += c;
+		return result;
+	}
+
+	auto fits(std::vector<std::string> const& operands, std::string const& result) const -> bool
+	{
+		// the final output is never limited, it has to be created anyway
+		return !_memory_limit.has_value() || operands.size() == 2 || size_of(result) <= _memory_limit.value();
+	}
+
+	auto contract(std::vector<std::string>& operands, Axes const& picked) const -> ContractionStep
+	{
+		auto result = result_of(operands, picked);
+
+		std::vector<std::string> lefts;
+		for (auto i : picked)
+			lefts.push_back(operands[i]);
+
+		for (auto i : sort_and_reverse(picked))
+			remove(operands, i);
+		operands.push_back(result);
+
+		return { picked, join(lefts, ",") + "->" + result };
+	}
+};
+
+// Lowering of a two operands contraction to a batched matrix product:
+// lhs is laid out as [batch, m, k], rhs as [batch, k, n], and the product
+// [batch, m, n] is transposed to the output order. Batch, m and n axes are
+// taken in output order and k axes in lhs order, so operands already in that
+// layout come with identity permutations.
+
+struct GemmLowering
+{
+	Axes lhs_permutation;		// lhs axes in [batch..., m..., k...] order
+	Axes rhs_permutation;		// rhs axes in [batch..., k..., n...] order
+	Shape lhs_shape;			// { batch, m, k }
+	Shape rhs_shape;			// { batch, k, n }
+	Shape product_shape;		// [batch..., m..., n...]
+	Axes output_permutation;	// from [batch..., m..., n...] to output order
+	bool has_batch{ false };
+	bool lhs_in_layout{ false };	// no permutation or reshape needed
+	bool rhs_in_layout{ false };
+	bool output_in_layout{ false };
+	Axes lhs_contracted;		// k axes positions, for tensordot
+	Axes rhs_contracted;
+	Axes tensordot_permutation;	// from [lhs free..., rhs free...] to output order
+};
+
+// ellipsis, repeated indices, broadcasting and indices summed in a single operand are left to einsum
+inline auto _prepare_gemm_lowering(std::string const& equation, Shape const& lhs_shape, Shape const& rhs_shape) -> std::optional<GemmLowering>
+{
+	if (contains(equation, "...") || !contains(equation, "->"))
+		return std::nullopt;
+
+	auto [lefts, output] = divide(equation, "->");
+	auto operands = splits(lefts, ",");
+	if (operands.size() != 2)
+		return std::nullopt;
+
+	auto&& lhs = operands[0];
+	auto&& rhs = operands[1];
+	if (lhs.size() != lhs_shape.size() || rhs.size() != rhs_shape.size())
+		return std::nullopt;
+
+	std::map<char, int64_t> sizes;
+	for (auto&& [operand, shape] : { std::tie(lhs, lhs_shape), std::tie(rhs, rhs_shape) })
+	{
+		for (auto&& [i, c] : iters::enumerate(operand))
+		{
+			if (count(operand, std::string(1, c)) > 1)
+				return std::nullopt;
+			if (sizes.count(c) && sizes[c] != shape[i])
+				return std::nullopt;
+			sizes[c] = shape[i];
+		}
+	}
+
+	std::string batch, m, n, k;
+	for (auto c : output)
+	{
+		if (count(output, std::string(1, c)) > 1 || !sizes.count(c))
+			return std::nullopt;
+
+		if (contains(lhs, c) && contains(rhs, c))
+			batch += c;
+		else
+		if (contains(lhs, c))
+			m += c;
+		else
+			n += c;
+	}
+
+	for (auto c : lhs)
+		if (!contains(output, c))
+		{
+			if (!contains(rhs, c))
+				return std::nullopt;
+			k += c;
+		}
+
+	for (auto c : rhs)
+		if (!contains(output, c) && !contains(lhs, c))
+			return std::nullopt;
+
+	auto positions = [](std::string const& operand, std::string const& letters)
+	{
+		Axes axes;
+		for (auto c : letters)
+			axes.push_back(operand.find(c));
+		return axes;
+	};
+
+	auto size_of = [&](std::string const& letters)
+	{
+		int64_t size = 1;
+		for (auto c : letters)
+			size *= sizes[c];
+		return size;
+	};
+
+	GemmLowering lowering;
+	lowering.lhs_permutation = positions(lhs, batch + m + k);
+	lowering.rhs_permutation = positions(rhs, batch + k + n);
+	lowering.lhs_shape = { size_of(batch), size_of(m), size_of(k) };
+	lowering.rhs_shape = { size_of(batch), size_of(k), size_of(n) };
+	for (auto c : batch + m + n)
+		lowering.product_shape.push_back(sizes[c]);
+	lowering.output_permutation = positions(batch + m + n, output);
+	lowering.has_batch = !batch.empty();
+
+	// operands already laid out for the GEMM skip their transpositions
+	auto is_identity = [](Axes const& permutation)
+	{
+		return compare<Axis>(permutation, iters::range<Axis>(permutation.size()).vec());
+	};
+	lowering.lhs_in_layout = is_identity(lowering.lhs_permutation) && compare<int64_t>(lhs_shape, lowering.lhs_shape);
+	lowering.rhs_in_layout = is_identity(lowering.rhs_permutation) && compare<int64_t>(rhs_shape, lowering.rhs_shape);
+	lowering.output_in_layout = is_identity(lowering.output_permutation);
+
+	std::string lhs_free, rhs_free;
+	for (auto c : lhs)
+		if (!contains(k, c))
+			lhs_free += c;
+	for (auto c : rhs)
+		if (!contains(k, c))
+			rhs_free += c;
+
+	lowering.lhs_contracted = positions(lhs, k);
+	lowering.rhs_contracted = positions(rhs, k);
+	lowering.tensordot_permutation = positions(lhs_free + rhs_free, output);
+
+	return lowering;
+}
+
+} // namespace implementation
+} // namespace einops
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <backends.hpp>
+#include <contraction.hpp>
 #include <parsing.hpp>
 
 namespace einops {
@@ -19,18 +20,112 @@ inline auto _product(std::vector<int64_t> const& sequence) -> int64_t
 	return result;
 }
 
+// elementary axes of the left side are numbered in order of appearance,
+// so each input composite axis covers a contiguous range of positions
+
+inline auto _classify_transformation_recipe(TransformRecipe const& recipe) -> KernelFamily
+{
+	auto n_axes = Axis(recipe.axes_permutation.size());
+
+	if (recipe.first_reduced_axis != n_axes || !recipe.added_axes.empty())
+		return KernelFamily::generic;
+
+	Axes input_sizes;
+	for (auto&& [known_axes, unknown_axes] : recipe.input_composition_known_unknown)
+		input_sizes.push_back(known_axes.size() + unknown_axes.size());
+
+	Axes output_sizes;
+	for (auto&& grouping : recipe.output_composite_axes)
+		output_sizes.push_back(grouping.size());
+
+	auto count_sizes = [](Axes const& sizes, auto&& condition)
+	{
+		return size_t(std::count_if(sizes.begin(), sizes.end(), condition));
+	};
+
+	auto input_composed  = count_sizes(input_sizes,  [](auto size) { return size > 1; });
+	auto output_composed = count_sizes(output_sizes, [](auto size) { return size > 1; });
+	auto input_flat  = count_sizes(input_sizes,  [](auto size) { return size == 1; }) == input_sizes.size();
+	auto output_flat = count_sizes(output_sizes, [](auto size) { return size == 1; }) == output_sizes.size();
+
+	auto is_identity = compare<Axis>(recipe.axes_permutation, iters::range<Axis>(n_axes).vec());
+
+	if (is_identity)
+		return (input_flat && output_flat) ? KernelFamily::identity : KernelFamily::view;
+
+	if (input_flat && output_flat)
+	{
+		if (n_axes == 2)
+			return KernelFamily::transpose;
+
+		auto batched = iters::range<Axis>(n_axes - 2).vec();
+			 batched.push_back(n_axes - 1);
+			 batched.push_back(n_axes - 2);
+
+		return compare<Axis>(recipe.axes_permutation, batched) ? KernelFamily::batched_transpose 
+															   : KernelFamily::permute;
+	}
+
+	// leading axes kept in place, as torch shuffles also accept any batch dimensions
+	auto k = input_sizes.size() >= 3 ? Axis(input_sizes.size() - 3) : Axis(0);
+	auto leading = OutputCompositeAxes();
+	for (auto axis : iters::range<Axis>(k))
+		leading.push_back({ axis });
+
+	auto with_leading = [&](OutputCompositeAxes const& groups)
+	{
+		auto output = leading;
+		output.insert(output.end(), groups.begin(), groups.end());
+		return output;
+	};
+
+	auto sizes_are = [&](Axes const& sizes, Axes const& tail)
+	{
+		auto expected = Axes(k, 1);
+		expected.insert(expected.end(), tail.begin(), tail.end());
+		return compare<Axis>(sizes, expected);
+	};
+
+	if (input_sizes.size() >= 3 && sizes_are(input_sizes, { 3, 1, 1 })
+		&& recipe.output_composite_axes == with_leading({ { k }, { k + 3, k + 1 }, { k + 4, k + 2 } }))
+		return KernelFamily::pixel_shuffle;
+
+	if (input_sizes.size() >= 3 && sizes_are(input_sizes, { 1, 2, 2 })
+		&& recipe.output_composite_axes == with_leading({ { k, k + 2, k + 4 }, { k + 1 }, { k + 3 } }))
+		return KernelFamily::pixel_unshuffle;
+
+	if (input_composed == 1 && output_flat)
+		return KernelFamily::head_split;
+
+	if (input_flat && output_composed == 1)
+		return KernelFamily::head_merge;
+
+	auto input_splits  = count_sizes(input_sizes,  [](auto size) { return size == 2; });
+	auto output_splits = count_sizes(output_sizes, [](auto size) { return size == 2; });
+
+	if (input_splits >= 2 && input_composed == input_splits && output_composed > 0)
+		return KernelFamily::patchify;
+
+	if (output_splits >= 2 && output_composed == output_splits && input_composed > 0)
+		return KernelFamily::unpatchify;
+
+	return KernelFamily::generic;
+}
+
 static LRUCache<Hash, TransformRecipe> _transformRecipeCache (256);
 
-auto _prepare_transformation_recipe(Pattern const& pattern, Reduction const& operation, AxesLengths const& axes_names, int64_t ndim) -> TransformRecipe
+auto _prepare_transformation_recipe(Pattern const& pattern, Reduction const& operation, AxesLengths const& axes_names, int64_t ndim) -> std::shared_ptr<const TransformRecipe>
 {
 	auto hash = HashBuilder()(pattern, operation, print(axes_names), print(ndim));
-	if (_transformRecipeCache.exists(hash))
-		return _transformRecipeCache.get(hash);
+	if (auto cached = _transformRecipeCache.find_local(hash))
+		return cached;
 
 	auto&& [left_str, rght_str] = divide(pattern, "->");
 
 	auto left = ParsedExpression(left_str);
 	auto rght = ParsedExpression(rght_str);
+	left.report_warnings();
+	rght.report_warnings();
 
 	if (!left.has_ellipsis && rght.has_ellipsis)
 		throw Exception(::format("Ellipsis found in right side, but not left side of a pattern {}", pattern));
@@ -315,9 +410,9 @@ auto _prepare_transformation_recipe(Pattern const& pattern, Reduction const& ope
 		hash // hold is own hash
 	};
 
-	_transformRecipeCache.put(hash, recipe);
+	recipe.family = _classify_transformation_recipe(recipe);
 
-	return recipe;
+	return _transformRecipeCache.put(hash, recipe);
 }
 
 template <typename AxesLengths>
@@ -403,34 +498,101 @@ inline auto _reconstruct_from_shape_uncached(TransformRecipe const& self, Shape
 static LRUCache<Hash, CookedRecipe> _reconstructFromShapeCache (1024);
 
 template <typename AxesLengths>
-inline auto _reconstruct_from_shape(TransformRecipe const& self, Shape const& shape, AxesLengths const& axes_dims) -> CookedRecipe
+inline auto _reconstruct_from_shape(TransformRecipe const& self, Shape const& shape, AxesLengths const& axes_dims) -> std::shared_ptr<const CookedRecipe>
 {
 	auto hash = HashBuilder()(self.hash, print(shape), print(axes_dims));
-	if (_reconstructFromShapeCache.exists(hash))
-		return _reconstructFromShapeCache.get(hash);
+	if (auto cached = _reconstructFromShapeCache.find_local(hash))
+		return cached;
+
+	return _reconstructFromShapeCache.put(hash, _reconstruct_from_shape_uncached(self, shape, axes_dims));
+}
 
-	auto recipe = _reconstruct_from_shape_uncached(self, shape, axes_dims);
+// the recipe of the rearrangement that undoes the given one, built from its groupings and
+// permutation: elementary axes are renumbered in the order of the forward output, which
+// becomes the input, and the forward input groups become the output groups
+inline auto _inverse_transformation_recipe(TransformRecipe const& recipe, Hash hash) -> TransformRecipe
+{
+	auto n_axes = recipe.axes_permutation.size();
+	if (recipe.first_reduced_axis != Axis(n_axes) || !recipe.added_axes.empty() || recipe.elementary_axes_lengths.size() != n_axes)
+		throw Exception("Only rearrangements can be inverted, the pattern reduces or adds axes");
 
-	_reconstructFromShapeCache.put(hash, recipe);
+	Axes renumbered (n_axes);
+	for (auto&& [position, axis] : iters::enumerate(recipe.axes_permutation))
+		renumbered[axis] = position;
 
-	return recipe;
+	TransformRecipe inverse;
+
+	inverse.elementary_axes_lengths.resize(n_axes);
+	for (auto&& [axis, length] : iters::enumerate(recipe.elementary_axes_lengths))
+		inverse.elementary_axes_lengths[renumbered[axis]] = length;
+
+	for (auto&& [axis_name, axis] : recipe.axis_name2elementary_axis)
+		inverse.axis_name2elementary_axis[axis_name] = renumbered[axis];
+
+	for (auto&& grouping : recipe.output_composite_axes)
+	{
+		Axes known, unknown;
+		for (auto&& axis : grouping)
+			(recipe.elementary_axes_lengths[axis] == _unknown_axis_length ? unknown : known).push_back(renumbered[axis]);
+
+		if (unknown.size() > 1)
+			throw Exception(format("Could not infer sizes of {} axes of a composed output axis, specify their lengths", print(int64_t(unknown.size()))));
+
+		inverse.input_composition_known_unknown.push_back({ known, unknown });
+	}
+
+	// forward axes are numbered left to right, sorting them restores the order of an input group
+	for (auto&& [known, unknown] : recipe.input_composition_known_unknown)
+	{
+		Axes forward_group;
+		for (auto&& axes : { known, unknown })
+			forward_group.insert(forward_group.end(), axes.begin(), axes.end());
+		std::sort(forward_group.begin(), forward_group.end());
+
+		Axes grouping;
+		for (auto&& axis : forward_group)
+			grouping.push_back(renumbered[axis]);
+		inverse.output_composite_axes.push_back(grouping);
+	}
+
+	for (auto axis : iters::range<Axis>(n_axes))
+		inverse.axes_permutation.push_back(renumbered[axis]);
+
+	inverse.first_reduced_axis = n_axes;
+	inverse.hash = hash;
+	inverse.family = _classify_transformation_recipe(inverse);
+
+	return inverse;
 }
 
-inline auto _prepare_recipes_for_all_dims(Pattern const& pattern, Reduction const& operation, AxesLengths const& axes_names) -> std::map<int64_t, TransformRecipe>
+static LRUCache<Hash, TransformRecipe> _inverseRecipeCache (256);
+
+// ndim is the one of the tensor to invert, i.e. of the forward output
+inline auto _prepare_inverse_recipe(Pattern const& pattern, AxesLengths const& axes_names, int64_t ndim) -> std::shared_ptr<const TransformRecipe>
 {
-	auto&& [left_str, _] = divide(pattern, "->");
-	auto&& left = ParsedExpression(left_str);
-	auto&& dims = Axes{ (Axis)left.composition.size() };
-	if (left.has_ellipsis)
+	auto hash = HashBuilder()(pattern, std::string("inverse"), print(axes_names), print(ndim));
+	if (auto cached = _inverseRecipeCache.find_local(hash))
+		return cached;
+
+	auto&& [left_str, rght_str] = divide(pattern, "->");
+
+	auto left = ParsedExpression(left_str);
+	auto rght = ParsedExpression(rght_str);
+
+	// the ellipsis covers as many dimensions on both sides
+	auto forward_ndim = int64_t(left.composition.size());
+	if (left.has_ellipsis && rght.has_ellipsis)
 	{
-		dims.clear();
-		for (auto ellipsis_dims : iters::range(8))
-			dims.push_back(left.composition.size() - 1 + ellipsis_dims);
+		if (rght.has_ellipsis_parenthesized)
+			throw Exception(format("Can't infer the dimensions of a parenthesized ellipsis to invert {}", pattern));
+		forward_ndim += ndim - int64_t(rght.composition.size());
 	}
-	std::map<int64_t, TransformRecipe> output;
-	for (auto&& ndim : dims) 
-		output[ndim] = _prepare_transformation_recipe(pattern, operation, axes_names, ndim);
-	return output;
+
+	auto forward = _prepare_transformation_recipe(pattern, "rearrange", axes_names, forward_ndim);
+	if (int64_t(forward->output_composite_axes.size()) != ndim)
+		throw Exception(format("Wrong shape: expected {} dims. Received {}-dim tensor.", print(int64_t(forward->output_composite_axes.size())), print(ndim)));
+
+	return _inverseRecipeCache.put(hash, _inverse_transformation_recipe(*forward, hash));
 }
 
 template <typename Tensor, typename Backend>
@@ -443,11 +605,33 @@ inline Tensor _reduce_axes(Tensor const& tensor, Reduction const& reduction_type
 	return backend.reduce(tensor, reduction_type, reduced_axes);
 }
 
-template <typename Tensor, typename Backend, typename AxesLengths>
-inline Tensor _apply_recipe(Backend& backend, TransformRecipe const& recipe, Tensor tensor, Reduction const& reduction_type, AxesLengths const& axes_lengths)
+// backend calls of a recipe cooked for the shape of the tensor
+template <typename Tensor, typename Backend>
+inline Tensor _apply_cooked_recipe(Backend& backend, TransformRecipe const& recipe, CookedRecipe const& cooked, Tensor tensor, Reduction const& reduction_type)
 {
-	auto&& [init_shapes, axes_reordering, reduced_axes, added_axes, final_shapes, n_axes_w_added] 
-		 = _reconstruct_from_shape(recipe, backend.shape(tensor), axes_lengths);
+	auto&& [init_shapes, axes_reordering, reduced_axes, added_axes, final_shapes, n_axes_w_added] = cooked;
+
+	switch (recipe.family)
+	{
+	case KernelFamily::view:
+		return backend.reshape(tensor, final_shapes.value_or(init_shapes.value_or(backend.shape(tensor))));
+	case KernelFamily::pixel_shuffle:
+	case KernelFamily::pixel_unshuffle:
+	{
+		// shuffle factors are the two inner axes of the channel (or spatial) groups
+		auto&& lengths = init_shapes.value();
+		auto k = lengths.size() - 5;
+		auto [h2, w2] = recipe.family == KernelFamily::pixel_shuffle ? std::make_tuple(lengths[k + 1], lengths[k + 2])
+																	 : std::make_tuple(lengths[k + 2], lengths[k + 4]);
+		if (h2 == w2)
+			return recipe.family == KernelFamily::pixel_shuffle ? backend.pixel_shuffle(tensor, h2)
+																: backend.pixel_unshuffle(tensor, h2);
+		break;
+	}
+	default:
+		// head split/merge and patchify are already views plus at most one copy
+		break;
+	}
 
 	if (init_shapes.has_value())
 		tensor = backend.reshape(tensor, init_shapes.value());
@@ -463,44 +647,102 @@ inline Tensor _apply_recipe(Backend& backend, TransformRecipe const& recipe, Ten
 	return tensor;
 }
 
-template <typename T>
-inline auto _validate_einsum_axis_name(T const& value) -> std::string
+template <typename Tensor, typename Backend, typename AxesLengths>
+inline Tensor _apply_recipe(Backend& backend, TransformRecipe const& recipe, Tensor tensor, Reduction const& reduction_type, AxesLengths const& axes_lengths)
 {
-	if (value.index() == 0)
+	// without axes lengths there is nothing to validate against the shape,
+	// so pure permutations don't even need the recipe to be cooked
+	if (axes_lengths.empty())
 	{
-		auto axis_names = std::get<0>(value);
+		switch (recipe.family)
+		{
+		case KernelFamily::identity:
+			return tensor;
+		case KernelFamily::transpose:
+		case KernelFamily::batched_transpose:
+		case KernelFamily::permute:
+			return backend.transpose(tensor, recipe.axes_permutation);
+		default:
+			break;
+		}
+	}
 
-		if (axis_names.size() == 0)
-			throw Exception("Singleton () axes are not yet supported in einsum.");
+	auto cooked = _reconstruct_from_shape(recipe, backend.shape(tensor), axes_lengths);
+	return _apply_cooked_recipe(backend, recipe, *cooked, tensor, reduction_type);
+}
 
-		if (axis_names.size() > 1)
-			throw Exception("Shape rearrangement is not yet supported in einsum.");
+template <typename Tensor, typename Backend, typename AxesLengths>
+inline std::vector<Tensor> _apply_recipe_split(Backend& backend, TransformRecipe const& recipe, Tensor tensor, AxesLengths const& axes_lengths)
+{
+	if (recipe.output_composite_axes.empty() || recipe.output_composite_axes.front().size() != 1)
+		throw Exception("Split needs a single elementary axis as first axis on the right side");
 
-		auto axis_name = axis_names[0];
-		
-		if (axis_name.empty())
-			throw Exception("Encountered empty axis name in einsum.");
+	auto cooked = _reconstruct_from_shape(recipe, backend.shape(tensor), axes_lengths);
+	auto&& [init_shapes, axes_reordering, reduced_axes, added_axes, final_shapes, n_axes_w_added] = *cooked;
+
+	// both steps are views, the split axis is the leading one after transposition
+	if (init_shapes.has_value())
+		tensor = backend.reshape(tensor, init_shapes.value());
+	if (axes_reordering.has_value())
+		tensor = backend.transpose(tensor, axes_reordering.value());
+
+	auto outputs = backend.unstack_on_zeroth_dimension(tensor);
 
-		return axis_name;
+	// at most one copy per output, never a stacked intermediate
+	if (final_shapes.has_value())
+	{
+		Axes output_shape (final_shapes.value().begin() + 1, final_shapes.value().end());
+		for (auto&& output : outputs)
+			output = backend.reshape(output, output_shape);
 	}
+
+	return outputs;
+}
+
+template <typename... Args>
+inline auto _hashable_axes_lengths(Args... axes_lengths) -> AxesLengths
+{
+	if constexpr (sizeof...(axes_lengths) > 0 && are_all_same<AxesLengthsMap, Args...>)
+		return from_map(axes_lengths...);
 	else
-	{
-		auto axis_name = std::get<1>(value);
+	if constexpr (sizeof...(axes_lengths) > 0)
+		return to_vector(std::tuple<Args...>(axes_lengths...));
+	else
+		return AxesLengths();
+}
+
+// elementary axes of one einsum operand dimension, ellipsis is a marker group
+
+template <typename T>
+inline auto _validate_einsum_axis_names(T const& value) -> AxesNames
+{
+	if (value.index() == 1)
+		return { std::get<1>(value) };
 
+	auto axis_names = std::get<0>(value);
+
+	for (auto&& axis_name : axis_names)
+	{
 		if (axis_name.empty())
 			throw Exception("Encountered empty axis name in einsum.");
 
-		return axis_name;
+		if (axis_name == _ellipsis)
+			throw Exception("Ellipsis inside parenthesis is not supported in einsum.");
+
+		if (!isidentifier(axis_name))
+			throw Exception(format("Anonymous axis {} is not supported in einsum.", axis_name));
 	}
+
+	return axis_names;
 }
 
-static LRUCache<Hash, std::string> _compactifyPatternForEinsumCache (256);
+static LRUCache<Hash, EinsumRecipe> _einsumRecipeCache (256);
 
-inline std::string _compactify_pattern_for_einsum(std::string const& pattern)
+inline auto _prepare_einsum_recipe(std::string const& pattern) -> EinsumRecipe
 {
 	auto hash = HashBuilder()(pattern);
-	if (_compactifyPatternForEinsumCache.exists(hash))
-		return _compactifyPatternForEinsumCache.get(hash);
+	if (auto cached = _einsumRecipeCache.find(hash))
+		return *cached;
 
 	if (!contains(pattern, "->"))
 		throw Exception("Einsum pattern must contain '->'.");
@@ -513,60 +755,796 @@ inline std::string _compactify_pattern_for_einsum(std::string const& pattern)
 		lefts.push_back(ParsedExpression(left, true, true));
 
 	auto right = ParsedExpression(right_str, true);
+	for (auto&& left : lefts)
+		left.report_warnings();
+	right.report_warnings();
 
 	std::string output_axis_names = ascii_letters;
-	int i = 0;
-	std::map<Identifier, std::string> axis_name_mapping;
+	EinsumRecipe recipe;
 
-	std::vector<std::string> left_patterns;
-	for (auto&& left : lefts)
+	// groups of the elementary axes, and their compact letters
+	auto compactify = [&](Composition const& composition, bool is_input, std::string& compact) -> CompositeAxes
 	{
-		std::string left_pattern = "";
-		for (auto&& raw_axis_name : left.composition)
+		CompositeAxes groups;
+		for (auto&& raw_axis_name : composition)
 		{
-			auto&& axis_name = _validate_einsum_axis_name(raw_axis_name);
+			auto axis_names = _validate_einsum_axis_names(raw_axis_name);
 
-			if (axis_name == _ellipsis)
+			if (axis_names.size() != 1)
+				recipe.needs_reshape = true;
+
+			if (raw_axis_name.index() == 1)
 			{
-				left_pattern += "...";
+				compact += "...";
+				groups.push_back(_ellipsis_not_in_parenthesis);
 				continue;
 			}
-			
-			if (!axis_name_mapping.count(axis_name))
+
+			Axes group;
+			for (auto&& axis_name : axis_names)
 			{
-				if (i >= output_axis_names.length())
-					throw Exception("Too many axes in einsum.");
+				auto axis = index(recipe.axes_names, axis_name);
+				if (axis < 0)
+				{
+					if (!is_input)
+						throw Exception(format("Unknown axis {} on right side of einsum {}.", axis_name, pattern));
 
-				axis_name_mapping[axis_name] = output_axis_names[i];
-				i += 1;
-			}
+					if (recipe.axes_names.size() >= output_axis_names.length())
+						throw Exception("Too many axes in einsum.");
 
-			left_pattern += axis_name_mapping[axis_name];
+					axis = recipe.axes_names.size();
+					recipe.axes_names.push_back(axis_name);
+				}
+				compact += output_axis_names[axis];
+				group.push_back(axis);
+			}
+			groups.push_back(group);
 		}
+		return groups;
+	};
+
+	std::vector<std::string> left_patterns;
+	for (auto&& left : lefts)
+	{
+		std::string left_pattern = "";
+		recipe.input_groups.push_back(compactify(left.composition, true, left_pattern));
 		left_patterns.push_back(left_pattern);
 	}
 
 	auto compact_pattern = join(left_patterns, ",") + "->";
+	recipe.output_groups = compactify(right.composition, false, compact_pattern);
+	recipe.compact_pattern = compact_pattern;
 
-	for (auto&& raw_axis_name : right.composition)
+	_einsumRecipeCache.put(hash, recipe);
+
+	return recipe;
+}
+
+inline std::string _compactify_pattern_for_einsum(std::string const& pattern)
+{
+	return _prepare_einsum_recipe(pattern).compact_pattern;
+}
+
+enum class EinsumEngine
+{
+	backend,	// backend einsum
+	ttgt,		// transpose-transpose-GEMM-transpose on the backend matmul
+};
+
+const auto _einsum_engines = std::vector<std::string>({ "backend", "ttgt" });
+
+struct EinsumOptions
+{
+	std::optional<int64_t> memory_limit; // elements of the largest intermediate of a contraction path
+	bool autotune{ false };				 // time the lowerings of each two operands contraction
+	EinsumEngine engine{ EinsumEngine::backend };
+};
+
+inline auto _einsum_options_mutex() -> std::mutex&
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+inline auto _einsum_options_storage() -> EinsumOptions&
+{
+	static EinsumOptions options;
+	return options;
+}
+
+// a copy taken once per einsum call, so that a call sees consistent options while they
+// are changed from other threads and its paths are cached under the limit they used
+inline auto _einsum_options() -> EinsumOptions
+{
+	std::lock_guard<std::mutex> lock(_einsum_options_mutex());
+	return _einsum_options_storage();
+}
+
+template <typename Function>
+inline void _update_einsum_options(Function&& update)
+{
+	std::lock_guard<std::mutex> lock(_einsum_options_mutex());
+	update(_einsum_options_storage());
+}
+
+static LRUCache<Hash, ContractionPath> _contractionPathCache (256);
+
+// paths only make sense for three operands or more, traces and ellipsis are left to the backend
+inline auto _prepare_contraction_path(std::string const& compact_pattern, Shapes const& shapes, std::optional<int64_t> const& memory_limit) -> std::optional<ContractionPath>
+{
+	if (shapes.size() < 3 || contains(compact_pattern, "..."))
+		return std::nullopt;
+
+	auto hash = HashBuilder()(compact_pattern, print(shapes), memory_limit.value_or(-1));
+	if (auto cached = _contractionPathCache.find(hash))
+		return *cached;
+
+	auto [lefts_str, output] = divide(compact_pattern, "->");
+	auto inputs = splits(lefts_str, ",");
+
+	if (inputs.size() != shapes.size())
+		throw Exception(format("Einsum pattern {} expects {} operands, received {}.", compact_pattern, inputs.size(), shapes.size()));
+
+	std::map<char, int64_t> sizes;
+	for (auto&& [i, input] : iters::enumerate(inputs))
 	{
-		auto&& axis_name = _validate_einsum_axis_name(raw_axis_name);
+		auto&& shape = shapes[i];
+		if (input.size() != shape.size())
+			throw Exception(format("Einsum operand {} expects {} dims, received {}.", input, input.size(), shape.size()));
 
-		if (axis_name == _ellipsis)
+		for (auto&& [j, c] : iters::enumerate(input))
+		{
+			if (count(input, std::string(1, c)) > 1)
+				return std::nullopt;
+
+			// broadcasted axes of length 1 take the length of the others
+			sizes[c] = std::max(sizes[c], shape[j]);
+		}
+	}
+
+	auto path = ContractionPathOptimizer(inputs, output, sizes, memory_limit).optimize();
+
+	_contractionPathCache.put(hash, path);
+
+	return path;
+}
+
+enum class EinsumLowering
+{
+	einsum,			// backend einsum
+	bmm,			// [batch, m, k] x [batch, k, n]
+	bmm_swapped,	// [batch, n, k] x [batch, k, m]
+	tensordot,		// without batch axes only
+};
+
+inline auto print(EinsumLowering lowering) -> std::string
+{
+	switch (lowering)
+	{
+	case EinsumLowering::bmm:			return "bmm";
+	case EinsumLowering::bmm_swapped:	return "bmm_swapped";
+	case EinsumLowering::tensordot:		return "tensordot";
+	default:							return "einsum";
+	}
+}
+
+struct EinsumDecision
+{
+	EinsumLowering lowering{ EinsumLowering::einsum };
+	std::optional<GemmLowering> plan;		// layout of the chosen lowering (swapped for bmm_swapped)
+	std::map<std::string, double> timings;	// microseconds of every candidate
+};
+
+// keyed on (equation, shapes, dtype, device), kept readable for inspection
+static std::map<std::string, EinsumDecision> _einsumAutotuneTable;
+static std::mutex _einsumAutotuneMutex;
+
+static LRUCache<Hash, std::optional<GemmLowering>> _gemmLoweringCache (256);
+
+inline auto _prepare_gemm_lowering_cached(std::string const& equation, Shape const& lhs_shape, Shape const& rhs_shape) -> std::optional<GemmLowering>
+{
+	auto hash = HashBuilder()(equation, print(lhs_shape), print(rhs_shape));
+	if (auto cached = _gemmLoweringCache.find(hash))
+		return *cached;
+
+	auto lowering = _prepare_gemm_lowering(equation, lhs_shape, rhs_shape);
+
+	_gemmLoweringCache.put(hash, lowering);
+
+	return lowering;
+}
+
+// the transpositions are views, the reshapes only copy operands that are not
+// already in GEMM layout, the final transposition is left as a view
+template <typename Tensor, typename Backend>
+inline Tensor _contract_gemm(Backend& backend, GemmLowering const& lowering, Tensor const& lhs, Tensor const& rhs)
+{
+	auto x = lhs;
+	if (!lowering.lhs_in_layout)
+		x = backend.reshape(backend.transpose(lhs, lowering.lhs_permutation), lowering.lhs_shape);
+
+	auto y = rhs;
+	if (!lowering.rhs_in_layout)
+		y = backend.reshape(backend.transpose(rhs, lowering.rhs_permutation), lowering.rhs_shape);
+
+	auto product = backend.reshape(backend.matmul(x, y), lowering.product_shape);
+	if (lowering.output_in_layout)
+		return product;
+
+	return backend.transpose(product, lowering.output_permutation);
+}
+
+template <typename Tensor, typename Backend>
+inline Tensor _contract_pair_with(Backend& backend, EinsumDecision const& decision, std::string const& equation, Tensor const& lhs, Tensor const& rhs)
+{
+	switch (decision.lowering)
+	{
+	case EinsumLowering::bmm:
+		return _contract_gemm(backend, decision.plan.value(), lhs, rhs);
+	case EinsumLowering::bmm_swapped:
+		return _contract_gemm(backend, decision.plan.value(), rhs, lhs);
+	case EinsumLowering::tensordot:
+	{
+		auto&& plan = decision.plan.value();
+		return backend.transpose(backend.tensordot(lhs, rhs, plan.lhs_contracted, plan.rhs_contracted), plan.tensordot_permutation);
+	}
+	default:
+		return backend.einsum(equation, { lhs, rhs });
+	}
+}
+
+// times every applicable lowering on the first encounter of a key (best of a few runs,
+// measured on the host clock so meant for CPU tensors) and keeps the fastest one
+template <typename Tensor, typename Backend>
+inline Tensor _contract_pair(Backend& backend, EinsumOptions const& options, std::string const& equation, Tensor const& lhs, Tensor const& rhs)
+{
+	if (!options.autotune && options.engine == EinsumEngine::backend)
+		return backend.einsum(equation, { lhs, rhs });
+
+	auto lhs_shape = backend.shape(lhs);
+	auto rhs_shape = backend.shape(rhs);
+
+	// the ttgt engine is the bmm lowering of the autotuner, without timing
+	if (!options.autotune)
+	{
+		auto plan = _prepare_gemm_lowering_cached(equation, lhs_shape, rhs_shape);
+		auto lowering = plan.has_value() ? EinsumLowering::bmm : EinsumLowering::einsum;
+		return _contract_pair_with(backend, { lowering, plan, {} }, equation, lhs, rhs);
+	}
+	auto key = ::format("{} {} {} {} {}", equation, print(lhs_shape), print(rhs_shape), backend.type_name(lhs), backend.device_name(lhs));
+
+	std::optional<EinsumDecision> known;
+	{
+		std::lock_guard<std::mutex> lock(_einsumAutotuneMutex);
+		auto it = _einsumAutotuneTable.find(key);
+		if (it != _einsumAutotuneTable.end())
+			known = it->second;
+	}
+	if (known.has_value())
+		return _contract_pair_with(backend, known.value(), equation, lhs, rhs);
+
+	std::vector<EinsumDecision> candidates = { { EinsumLowering::einsum, std::nullopt, {} } };
+
+	if (auto plan = _prepare_gemm_lowering_cached(equation, lhs_shape, rhs_shape))
+	{
+		candidates.push_back({ EinsumLowering::bmm, plan, {} });
+		if (!plan.value().has_batch)
+			candidates.push_back({ EinsumLowering::tensordot, plan, {} });
+
+		auto [lefts, output] = divide(equation, "->");
+		auto operands = splits(lefts, ",");
+		auto swapped = operands[1] + "," + operands[0] + "->" + output;
+		candidates.push_back({ EinsumLowering::bmm_swapped, _prepare_gemm_lowering_cached(swapped, rhs_shape, lhs_shape), {} });
+	}
+
+	// nothing to choose from, the decision is stored untimed
+	if (candidates.size() == 1)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_einsumAutotuneMutex);
+			_einsumAutotuneTable[key] = candidates.front();
+		}
+		return backend.einsum(equation, { lhs, rhs });
+	}
+
+	using clock = std::chrono::steady_clock;
+
+	EinsumDecision decision;
+	std::optional<double> best;
+	std::optional<Tensor> result;
+	for (auto&& candidate : candidates)
+	{
+		auto output = _contract_pair_with(backend, candidate, equation, lhs, rhs); // warmup
+		auto timing = std::numeric_limits<double>::max();
+		for (auto _ : iters::range(3))
+		{
+			auto start = clock::now();
+			output = _contract_pair_with(backend, candidate, equation, lhs, rhs);
+			timing = std::min(timing, std::chrono::duration<double, std::micro>(clock::now() - start).count());
+		}
+		decision.timings[print(candidate.lowering)] = timing;
+
+		if (!best.has_value() || timing < best.value())
 		{
-			compact_pattern += "...";
+			best = timing;
+			result = output;
+			decision.lowering = candidate.lowering;
+			decision.plan = candidate.plan;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_einsumAutotuneMutex);
+		_einsumAutotuneTable[key] = decision;
+	}
+
+	return result.value();
+}
+
+template <typename Tensor, typename Backend>
+inline Tensor _einsum(Backend& backend, EinsumOptions const& options, std::string const& compact_pattern, std::vector<Tensor> const& tensors)
+{
+	if (tensors.size() == 2)
+		return _contract_pair(backend, options, compact_pattern, tensors[0], tensors[1]);
+
+	Shapes shapes;
+	for (auto&& tensor : tensors)
+		shapes.push_back(backend.shape(tensor));
+
+	auto path = _prepare_contraction_path(compact_pattern, shapes, options.memory_limit);
+	if (!path.has_value())
+		return backend.einsum(compact_pattern, tensors);
+
+	auto operands = tensors;
+	for (auto&& [picked, equation] : path.value())
+	{
+		std::vector<Tensor> contracted;
+		for (auto i : picked)
+			contracted.push_back(operands[i]);
+
+		for (auto i : sort_and_reverse(picked))
+			remove(operands, i);
+
+		operands.push_back(contracted.size() == 2 ? _contract_pair(backend, options, equation, contracted[0], contracted[1])
+												  : backend.einsum(equation, contracted));
+	}
+
+	return operands.back();
+}
+
+// operand of einsum that is not expected to change between calls
+template <typename Tensor>
+struct Constant
+{
+	Tensor tensor;
+};
+
+template <typename Tensor>
+struct ConstantContraction
+{
+	std::vector<Tensor> operands;	// held so that their identities can't be reused by other tensors
+	std::vector<int64_t> versions;
+	std::vector<Tensor> results;	// one per component
+};
+
+template <typename Tensor>
+inline auto _constant_contraction_cache() -> LRUCache<Hash, ConstantContraction<Tensor>>&
+{
+	static LRUCache<Hash, ConstantContraction<Tensor>> _constantContractionCache (64);
+	return _constantContractionCache;
+}
+
+struct ConstantSplit
+{
+	std::vector<Axes> components;		// positions of the constant operands contracted together
+	std::vector<std::string> equations;	// contraction of each component
+	std::string equation;				// other operands then component results, empty when all is constant
+};
+
+// splits "ab,bc,cd->ad" with constant "bc" and "cd" into the contraction of the
+// constants "bc,cd->bd" and the remaining contraction "ab,bd->ad". Only constants
+// sharing an index, directly or through other constants, are contracted together,
+// and a component is left as is when its result has more elements than its operands
+inline auto _split_constant_equation(std::string const& equation, std::vector<bool> const& constants, std::vector<Shape> const& shapes) -> std::optional<ConstantSplit>
+{
+	if (contains(equation, "..."))
+		return std::nullopt;
+
+	auto [lefts, output] = divide(equation, "->");
+	auto operands = splits(lefts, ",");
+	if (operands.size() != constants.size() || operands.size() != shapes.size())
+		return std::nullopt;
+
+	std::map<char, int64_t> lengths;
+	for (auto&& [operand, shape] : iters::zip(operands, shapes))
+		for (auto&& [c, length] : iters::zip(operand, shape))
+			lengths[c] = std::max(lengths[c], length);
+
+	auto shares_index = [](std::string const& lhs, std::string const& rhs)
+	{
+		return std::any_of(lhs.begin(), lhs.end(), [&](char c) { return contains(rhs, c); });
+	};
+
+	Axes component_of (operands.size(), -1);
+	std::vector<Axes> components;
+	for (auto&& [i, operand] : iters::enumerate(operands))
+	{
+		if (!constants[i] || component_of[i] >= 0)
 			continue;
+
+		component_of[i] = components.size();
+		Axes component = { Axis(i) };
+		for (size_t member = 0; member < component.size(); ++member)
+			for (auto&& [j, other] : iters::enumerate(operands))
+				if (constants[j] && component_of[j] < 0 && shares_index(operands[component[member]], other))
+				{
+					component_of[j] = components.size();
+					component.push_back(j);
+				}
+		components.push_back(component);
+	}
+
+	if (components.empty())
+		return std::nullopt;
+	if (components.size() == 1 && components.front().size() == operands.size())
+		return ConstantSplit{ components, { equation }, std::string() };
+
+	ConstantSplit split;
+	std::vector<bool> contracted (operands.size(), false);
+	std::vector<std::string> results;
+	for (auto&& [n, component] : iters::enumerate(components))
+	{
+		std::string needed = output;
+		for (auto&& [j, operand] : iters::enumerate(operands))
+			if (component_of[j] != Axis(n))
+				needed += operand;
+
+		std::string result;
+		std::vector<std::string> inputs;
+		int64_t input_elements = 0;
+		for (auto member : component)
+		{
+			inputs.push_back(operands[member]);
+			input_elements += prod(shapes[member]);
+			for (auto c : operands[member])
+				if (contains(needed, c) && !contains(result, c))
+					result += c;
 		}
-	
-		if (!axis_name_mapping.count(axis_name))
-			throw Exception(format("Unknown axis {} on right side of einsum {}.", axis_name, pattern));
 
-		compact_pattern += axis_name_mapping[axis_name];
+		int64_t result_elements = 1;
+		for (auto c : result)
+			result_elements *= lengths[c];
+
+		// a single constant that keeps all its indices has nothing to pre-contract
+		if (component.size() == 1 && result == operands[component.front()])
+			continue;
+		if (result_elements > input_elements)
+			continue;
+
+		for (auto member : component)
+			contracted[member] = true;
+		split.components.push_back(component);
+		split.equations.push_back(join(inputs, ",") + "->" + result);
+		results.push_back(result);
+	}
+
+	if (split.components.empty())
+		return std::nullopt;
+
+	std::vector<std::string> remaining;
+	for (auto&& [i, operand] : iters::enumerate(operands))
+		if (!contracted[i])
+			remaining.push_back(operand);
+	remaining.insert(remaining.end(), results.begin(), results.end());
+
+	split.equation = join(remaining, ",") + "->" + output;
+	return split;
+}
+
+// the constant components are contracted once and reused as long as their operands are
+// the same tensors, with the same shapes and unmodified in-place, sources are the operands
+// as given, before they are reshaped to elementary axes. A cached result would hold the
+// autograd graph of the call that made it, so constants recorded by autograd are
+// contracted again on every call and never cached
+template <typename Tensor, typename Backend>
+inline Tensor _einsum_with_constants(Backend& backend, std::string const& compact_pattern, std::vector<Tensor> const& tensors, std::vector<bool> const& constants, std::vector<Tensor> const& sources)
+{
+	auto options = _einsum_options();
+
+	if (std::find(constants.begin(), constants.end(), true) == constants.end())
+		return _einsum(backend, options, compact_pattern, tensors);
+
+	std::vector<Shape> shapes;
+	for (auto&& tensor : tensors)
+		shapes.push_back(backend.shape(tensor));
+
+	auto split = _split_constant_equation(compact_pattern, constants, shapes);
+	if (!split.has_value())
+		return _einsum(backend, options, compact_pattern, tensors);
+
+	auto&& [components, equations, equation] = split.value();
+
+	std::vector<Tensor> held;
+	std::vector<int64_t> versions;
+	std::vector<bool> contracted (tensors.size(), false);
+	auto recorded = false;
+	auto hash = HashBuilder()(compact_pattern);
+	for (auto&& component : components)
+		for (auto member : component)
+		{
+			auto&& source = sources[member];
+			contracted[member] = true;
+			recorded = recorded || backend.records_gradient(source);
+			held.push_back(source);
+			versions.push_back(backend.version(source));
+			hash = HashBuilder()(hash, backend.identity(source), print(backend.shape(source)));
+		}
+
+	auto&& cache = _constant_contraction_cache<Tensor>();
+
+	std::vector<Tensor> results;
+	if (!recorded)
+	{
+		if (auto entry = cache.find(hash))
+		{
+			if (entry->versions == versions)
+				results = entry->results;
+		}
+	}
+
+	if (results.empty())
+	{
+		for (auto&& [component, component_equation] : iters::zip(components, equations))
+		{
+			std::vector<Tensor> operands;
+			for (auto member : component)
+				operands.push_back(tensors[member]);
+			results.push_back(_einsum(backend, options, component_equation, operands));
+		}
+		if (!recorded)
+			cache.put(hash, { held, versions, results });
+	}
+
+	if (equation.empty())
+		return results.front();
+
+	std::vector<Tensor> operands;
+	for (auto&& [tensor, is_contracted] : iters::zip(tensors, contracted))
+		if (!is_contracted)
+			operands.push_back(tensor);
+	operands.insert(operands.end(), results.begin(), results.end());
+
+	return _einsum(backend, options, equation, operands);
+}
+
+template <typename Tensor, typename Backend>
+inline Tensor _apply_einsum_recipe(Backend& backend, EinsumRecipe const& recipe, std::vector<Tensor> tensors, AxesLengths const& axes_lengths, std::vector<bool> const& constants = {})
+{
+	if (!recipe.needs_reshape && axes_lengths.empty())
+		return _einsum_with_constants(backend, recipe.compact_pattern, tensors, constants, tensors);
+
+	Axes lengths (recipe.axes_names.size(), -1);
+	for (auto&& [axis_name, length] : axes_lengths)
+	{
+		auto axis = index(recipe.axes_names, axis_name);
+		if (axis < 0)
+			throw Exception(format("Axis {} is not used in einsum.", axis_name));
+		lengths[axis] = length;
+	}
+
+	if (tensors.size() != recipe.input_groups.size())
+		throw Exception(format("Einsum pattern {} expects {} operands, received {}.", recipe.compact_pattern, recipe.input_groups.size(), tensors.size()));
+
+	// lengths of the operand dimensions covered by each group, ellipsis covers any number of them
+	auto group_dims = [](CompositeAxes const& groups, Shape const& shape) -> std::vector<Shape>
+	{
+		auto has_ellipsis = contains(groups, _ellipsis_not_in_parenthesis);
+		auto n_groups = static_cast<int64_t>(groups.size()) - (has_ellipsis ? 1 : 0);
+		auto n_dims = static_cast<int64_t>(shape.size());
+		if (has_ellipsis ? n_dims < n_groups : n_dims != n_groups)
+			throw Exception(format("Wrong shape: expected {} dims. Received {}-dim tensor.", n_groups, n_dims));
+
+		std::vector<Shape> dims;
+		auto cursor = shape.begin();
+		for (auto&& group : groups)
+		{
+			auto n = group == _ellipsis_not_in_parenthesis ? n_dims - n_groups : 1;
+			dims.push_back(Shape(cursor, cursor + n));
+			cursor += n;
+		}
+		return dims;
+	};
+
+	std::vector<std::vector<Shape>> operands_dims;
+	for (auto&& [tensor, groups] : iters::zip(tensors, recipe.input_groups))
+		operands_dims.push_back(group_dims(groups, backend.shape(tensor)));
+
+	// single axes first, as they give the lengths needed to split compositions
+	for (auto&& composite : { false, true })
+	{
+		for (auto&& [groups, dims] : iters::zip(recipe.input_groups, operands_dims))
+		{
+			for (auto&& [group, dim] : iters::zip(groups, dims))
+			{
+				if (group == _ellipsis_not_in_parenthesis || (group.size() > 1) != composite)
+					continue;
+
+				auto length = dim.front();
+
+				if (group.empty())
+				{
+					if (length != 1)
+						throw Exception(format("Singleton () axis expects length 1, received {}.", length));
+					continue;
+				}
+
+				// single axes may be broadcasted from length 1
+				if (group.size() == 1)
+				{
+					auto&& known_length = lengths[group.front()];
+					if (known_length > 1 && length > 1 && known_length != length)
+						throw Exception(format("Shape mismatch for axis {}, {} != {}", recipe.axes_names[group.front()], length, known_length));
+					if (known_length < 0 || known_length == 1)
+						known_length = length;
+					continue;
+				}
+
+				Axes unknown;
+				int64_t known_product = 1;
+				for (auto axis : group)
+				{
+					if (lengths[axis] < 0)
+						unknown.push_back(axis);
+					else
+						known_product *= lengths[axis];
+				}
+
+				if (unknown.size() > 1)
+				{
+					AxesNames names;
+					for (auto axis : unknown)
+						names.push_back(recipe.axes_names[axis]);
+					throw Exception(format("Could not infer sizes for {}", print(names)));
+				}
+
+				if (unknown.empty())
+				{
+					if (length != known_product)
+						throw Exception(format("Shape mismatch, {} != {}", length, known_product));
+				}
+				else
+				{
+					if (length % known_product != 0)
+						throw Exception(format("Shape mismatch, can't divide axis of length {} in chunks of {}", length, known_product));
+					lengths[unknown.front()] = length / known_product;
+				}
+			}
+		}
+	}
+
+	// splitting axes and dropping singletons are views of the operands
+	auto sources = tensors;
+	for (auto&& [tensor, groups, dims] : iters::zip(tensors, recipe.input_groups, operands_dims))
+	{
+		auto is_flat = std::all_of(groups.begin(), groups.end(), [](Axes const& group) { return group.size() == 1; });
+		if (is_flat)
+			continue;
+
+		Shape elementary_shape;
+		for (auto&& [group, dim] : iters::zip(groups, dims))
+		{
+			if (group == _ellipsis_not_in_parenthesis)
+				elementary_shape.insert(elementary_shape.end(), dim.begin(), dim.end());
+			else
+			if (group.size() == 1)
+				elementary_shape.push_back(dim.front());
+			else
+				for (auto axis : group)
+					elementary_shape.push_back(lengths[axis]);
+		}
+		tensor = backend.reshape(tensor, elementary_shape);
+	}
+
+	auto result = _einsum_with_constants(backend, recipe.compact_pattern, tensors, constants, sources);
+
+	auto&& groups = recipe.output_groups;
+	if (std::all_of(groups.begin(), groups.end(), [](Axes const& group) { return group.size() == 1; }))
+		return result;
+
+	// merge the output groups, their lengths are read back from the result
+	auto result_shape = backend.shape(result);
+	int64_t n_elementary = 0;
+	for (auto&& group : groups)
+		if (group != _ellipsis_not_in_parenthesis)
+			n_elementary += group.size();
+
+	Shape final_shape;
+	auto cursor = result_shape.begin();
+	for (auto&& group : groups)
+	{
+		auto n = group == _ellipsis_not_in_parenthesis ? int64_t(result_shape.size()) - n_elementary : int64_t(group.size());
+		if (group == _ellipsis_not_in_parenthesis)
+			final_shape.insert(final_shape.end(), cursor, cursor + n);
+		else
+			final_shape.push_back(std::accumulate(cursor, cursor + n, int64_t(1), std::multiplies<int64_t>()));
+		cursor += n;
 	}
 
-	_compactifyPatternForEinsumCache.put(hash, compact_pattern);
+	return backend.reshape(result, final_shape);
+}
+
+static LRUCache<Hash, EinsumRecipe> _batchedEinsumRecipeCache (256);
+
+// the same contraction over a new leading axis of the stacked operands and of the
+// output, operands shared by every operand set are used as they are
+inline auto _prepare_batched_einsum_recipe(std::string const& pattern, std::vector<bool> const& stacked) -> EinsumRecipe
+{
+	auto hash = HashBuilder()(pattern, stacked);
+	if (auto cached = _batchedEinsumRecipeCache.find(hash))
+		return *cached;
+
+	auto recipe = _prepare_einsum_recipe(pattern);
+	if (recipe.input_groups.size() != stacked.size())
+		throw Exception(format("Einsum pattern {} expects {} operands, received {}.", pattern, recipe.input_groups.size(), stacked.size()));
+
+	auto axis = Axis(recipe.axes_names.size());
+	if (axis >= Axis(ascii_letters.length()))
+		throw Exception("Too many axes in einsum.");
+
+	// not an identifier, so it can't collide with the axes of the pattern
+	recipe.axes_names.push_back("(batch)");
+	auto letter = std::string(1, ascii_letters[axis]);
+
+	auto [lefts, output] = divide(recipe.compact_pattern, "->");
+	auto operands = splits(lefts, ",");
+	for (auto&& [operand, groups, is_stacked] : iters::zip(operands, recipe.input_groups, stacked))
+	{
+		if (!is_stacked)
+			continue;
+		operand = letter + operand;
+		groups.insert(groups.begin(), Axes{ axis });
+	}
+	recipe.output_groups.insert(recipe.output_groups.begin(), Axes{ axis });
+	recipe.compact_pattern = join(operands, ",") + "->" + letter + output;
+
+	_batchedEinsumRecipeCache.put(hash, recipe);
+
+	return recipe;
+}
+
+template <typename Arg>
+struct _einsum_tensor { using type = Arg; };
+
+template <typename Tensor>
+struct _einsum_tensor<Constant<Tensor>> { using type = Tensor; };
 
-	return compact_pattern;
+template <typename Tensor, typename... Args>
+inline void _split_einsum_arguments(std::vector<Tensor>& tensors, std::vector<bool>& constants, AxesLengths& axes_lengths, Args const&... args)
+{
+	auto dispatch = [&](auto const& arg)
+	{
+		using Arg = std::decay_t<decltype(arg)>;
+		if constexpr (std::is_same_v<Arg, std::tuple<std::string, int64_t>>)
+			axes_lengths.push_back(arg);
+		else
+		if constexpr (std::is_same_v<Arg, AxesLengthsMap>)
+		{
+			for (auto&& [axis_name, length] : arg)
+				axes_lengths.push_back({ axis_name, length });
+		}
+		else
+		if constexpr (std::is_same_v<Arg, Constant<Tensor>>)
+		{
+			tensors.push_back(arg.tensor);
+			constants.push_back(true);
+		}
+		else
+		{
+			tensors.push_back(arg);
+			constants.push_back(false);
+		}
+	};
+	(dispatch(args), ...);
 }
 
 } // namespace implementation
@@ -590,24 +1568,9 @@ auto reduce(Tensor const& tensors, std::string const& pattern, std::string const
 
 	try
 	{
-		if constexpr (sizeof...(axes_lengths) > 0 && are_all_same<AxesLengthsMap, Args...>)
-		{
-			hashable_axes_lengths = from_map(axes_lengths...);
-			auto recipe = _prepare_transformation_recipe(pattern, reduction, hashable_axes_lengths, shape.size());
-			return _apply_recipe(backend, recipe, tensor, reduction, hashable_axes_lengths);
-		}
-		else
-		if constexpr (sizeof...(axes_lengths) > 0)
-		{
-			hashable_axes_lengths = to_vector(std::tuple<Args...>(axes_lengths...));
-			auto recipe = _prepare_transformation_recipe(pattern, reduction, hashable_axes_lengths, shape.size());
-			return _apply_recipe(backend, recipe, tensor, reduction, hashable_axes_lengths);
-		}
-		else
-		{
-			auto recipe = _prepare_transformation_recipe(pattern, reduction, AxesLengths(), shape.size());
-			return _apply_recipe(backend, recipe, tensor, reduction, AxesLengths());
-		}
+		hashable_axes_lengths = _hashable_axes_lengths(axes_lengths...);
+		auto recipe = _prepare_transformation_recipe(pattern, reduction, hashable_axes_lengths, shape.size());
+		return _apply_recipe(backend, *recipe, tensor, reduction, hashable_axes_lengths);
 	}
 	catch (Exception const& e)
 	{
@@ -632,6 +1595,71 @@ auto rearrange(Tensor const& tensor, std::string const& pattern, Args... axes_le
 	return reduce(tensor, pattern, "rearrange", axes_lengths...);
 }
 
+/// @brief Undoes rearrange(tensor, pattern, axes_lengths...), e.g. unpatchify with the patchify pattern.
+/// The recipe is derived from the one of the pattern, without writing or parsing the reversed pattern.
+/// @param tensor tensor of any supported library (only libtorch in this version)
+/// list of tensors is also accepted, those should be of the same type and shape
+/// @param pattern string, rearrangement pattern to invert
+/// @param axes_lengths any additional specifications for dimensions, composed output axes
+/// need all their lengths but one
+/// @return tensor of the same type as input.
+template <typename Tensor, typename... Args>
+auto inverse(Tensor const& tensors, std::string const& pattern, Args... axes_lengths)
+{
+	using namespace implementation;
+
+	auto&& [backend, tensor] = backends::get_backend(tensors);
+	auto&& shape = backend.shape(tensor);
+
+	AxesLengths hashable_axes_lengths;
+
+	try
+	{
+		hashable_axes_lengths = _hashable_axes_lengths(axes_lengths...);
+		auto recipe = _prepare_inverse_recipe(pattern, hashable_axes_lengths, shape.size());
+		return _apply_recipe(backend, *recipe, tensor, "rearrange", hashable_axes_lengths);
+	}
+	catch (Exception const& e)
+	{
+		auto message  = ::format("\n\n Error while processing inverse-rearrange pattern \"{}\".", pattern);
+			 message += ::format("\n Input tensor shape: {}. ", print(shape));
+			 message += ::format("Additional info: {}.", print(hashable_axes_lengths));
+		throw Exception(message + ::format("\n {}", e.what()));
+	}
+}
+
+/// @brief Rearrangement that splits the result along its first axis, e.g. fused projections:
+/// "b n (three h d) -> three b h n d". Each output is a view or a single copy of the input,
+/// the stacked result of the equivalent rearrange is never materialized.
+/// @param tensor tensor of any supported library (only libtorch in this version)
+/// @param pattern string, rearrangement pattern where the first right axis is elementary
+/// @param axes_lengths any additional specifications for dimensions
+/// @return list of tensors, one for each index along the first right axis.
+template <typename Tensor, typename... Args>
+auto rearrange_split(Tensor const& tensors, std::string const& pattern, Args... axes_lengths)
+{
+	using namespace implementation;
+
+	auto&& [backend, tensor] = backends::get_backend(tensors);
+	auto&& shape = backend.shape(tensor);
+
+	AxesLengths hashable_axes_lengths;
+
+	try
+	{
+		hashable_axes_lengths = _hashable_axes_lengths(axes_lengths...);
+		auto recipe = _prepare_transformation_recipe(pattern, "rearrange", hashable_axes_lengths, shape.size());
+		return _apply_recipe_split(backend, *recipe, tensor, hashable_axes_lengths);
+	}
+	catch (Exception const& e)
+	{
+		auto message  = ::format("\n\n Error while processing split-rearrange pattern \"{}\".", pattern);
+			 message += ::format("\n Input tensor shape: {}. ", print(shape));
+			 message += ::format("Additional info: {}.", print(hashable_axes_lengths));
+		throw Exception(message + ::format("\n {}", e.what()));
+	}
+}
+
 /// @brief Reader-friendly smart element reordering for multidimensional tensors.
 /// This operation includes functionality of repeat, tile, broadcast functions.
 /// @param tensor tensor of any supported library (only libtorch in this version)
@@ -648,17 +1676,184 @@ auto repeat(Tensor const& tensor, std::string const& pattern, Args... axes_lengt
 /// @brief Calls einsum operations with einops-style named axes indexing,
 /// computing tensor products with an arbitrary number of tensors. 
 /// Unlike python version, you need to pass pattern first, ant then the tensor(s).
+/// Three operands or more are contracted pairwise in the cheapest order found.
+/// Composite axes, e.g. "b n (h d), b m (h d) -> b h n m", are split and merged as views
+/// around a single contraction, lengths that can't be inferred are given with axis(key, value).
+/// Operands wrapped with constant(tensor) that share an axis are contracted together once,
+/// the result is reused until one of them is replaced or modified in-place.
 /// @param pattern string in einops-style.
-/// @param tensor one or more tensor where is type is supported by the backends.
+/// @param tensor one or more tensor where is type is supported by the backends,
+/// followed by any additional specifications for dimensions
 /// @return tensor of the same type as input.
-template <typename... Tensor>
-auto einsum(std::string const& pattern, Tensor... tensor)
+template <typename... Args>
+auto einsum(std::string const& pattern, Args... args)
 {
-	static_assert(sizeof...(Tensor) > 0, "einsum() needs at least one Tensor after pattern");
+	static_assert(sizeof...(Args) > 0, "einsum() needs at least one Tensor after pattern");
 	using namespace implementation;
-	auto&& tensors = ::to_vector(std::tuple<Tensor...>(tensor...));
+	using Tensor = typename _einsum_tensor<std::tuple_element_t<0, std::tuple<Args...>>>::type;
+	std::vector<Tensor> tensors;
+	std::vector<bool> constants;
+	AxesLengths axes_lengths;
+	_split_einsum_arguments(tensors, constants, axes_lengths, args...);
 	auto&& [backend, _] = backends::get_backend(tensors[0]);
-	return backend.einsum(_compactify_pattern_for_einsum(pattern), tensors);
+	return _apply_einsum_recipe(backend, _prepare_einsum_recipe(pattern), tensors, axes_lengths, constants);
+}
+
+/// @brief Same einsum over many operand sets, e.g. scoring candidate groups. Operand sets
+/// of the same shapes, dtypes and devices are stacked and contracted at once, operands shared
+/// by a whole group (the same tensor) are not stacked, and the results are views of the
+/// batched result. A group sharing all of its operands is contracted once.
+/// @param pattern string in einops-style.
+/// @param operand_sets tuples of tensors, one tuple for each einsum
+/// @param axes_lengths any additional specifications for dimensions
+/// @return list of tensors, the result of einsum for each operand set, in order.
+template <typename Tensor, typename... Tensors, typename... Args>
+auto einsum_batched(std::string const& pattern, std::vector<std::tuple<Tensor, Tensors...>> const& operand_sets, Args... axes_lengths)
+{
+	using namespace implementation;
+
+	std::vector<Tensor> results (operand_sets.size());
+	if (operand_sets.empty())
+		return results;
+
+	auto hashable_axes_lengths = _hashable_axes_lengths(axes_lengths...);
+	auto&& [backend, _] = backends::get_backend(std::get<0>(operand_sets.front()));
+
+	std::vector<std::vector<Tensor>> sets;
+	std::map<std::tuple<Shapes, std::vector<std::string>, std::vector<std::string>>, Axes> groups;
+	for (auto&& [i, operand_set] : iters::enumerate(operand_sets))
+	{
+		sets.push_back(std::apply([](auto const&... tensors) { return std::vector<Tensor>{ tensors... }; }, operand_set));
+
+		Shapes shapes;
+		std::vector<std::string> types, devices;
+		for (auto&& tensor : sets.back())
+		{
+			shapes.push_back(backend.shape(tensor));
+			types.push_back(backend.type_name(tensor));
+			devices.push_back(backend.device_name(tensor));
+		}
+		groups[{ shapes, types, devices }].push_back(i);
+	}
+
+	for (auto&& [key, members] : groups)
+	{
+		auto&& first = sets[members.front()];
+		if (members.size() == 1)
+		{
+			results[members.front()] = _apply_einsum_recipe(backend, _prepare_einsum_recipe(pattern), first, hashable_axes_lengths);
+			continue;
+		}
+
+		std::vector<bool> stacked;
+		std::vector<Tensor> operands;
+		for (auto position : iters::range(first.size()))
+		{
+			std::vector<Tensor> tensors;
+			for (auto member : members)
+				tensors.push_back(sets[member][position]);
+
+			auto shared = std::all_of(tensors.begin(), tensors.end(), [&](Tensor const& tensor)
+			{
+				return backend.identity(tensor) == backend.identity(tensors.front());
+			});
+			stacked.push_back(!shared);
+			operands.push_back(shared ? tensors.front() : backend.stack_on_zeroth_dimension(tensors));
+		}
+
+		std::vector<Tensor> outputs;
+		if (std::none_of(stacked.begin(), stacked.end(), [](bool value) { return value; }))
+		{
+			// the same operands in every set, the einsum is computed once for the whole group
+			auto result = _apply_einsum_recipe(backend, _prepare_einsum_recipe(pattern), operands, hashable_axes_lengths);
+			outputs = backend.unstack_on_zeroth_dimension(backend.stack_on_zeroth_dimension(std::vector<Tensor>(members.size(), result)));
+		}
+		else
+		{
+			auto recipe = _prepare_batched_einsum_recipe(pattern, stacked);
+			outputs = backend.unstack_on_zeroth_dimension(_apply_einsum_recipe(backend, recipe, operands, hashable_axes_lengths));
+		}
+		for (auto&& [member, output] : iters::zip(members, outputs))
+			results[member] = output;
+	}
+
+	return results;
+}
+
+/// @brief Marks an operand of einsum as constant, e.g. weights at inference time:
+/// einsum("b i, i j, j k -> b k", x, constant(w1), constant(w2)) contracts w1 and w2
+/// only on the first call. Constants that require grad while grad mode is enabled are
+/// contracted on every call instead, so that each backward gets its own graph.
+/// @param tensor tensor of any supported library
+/// @return wrapper to pass to einsum in place of the tensor.
+template <typename Tensor>
+auto constant(Tensor const& tensor)
+{
+	return implementation::Constant<Tensor>{ tensor };
+}
+
+/// @brief Enables the einsum autotuner (disabled by default). On the first encounter of a
+/// (pattern, shapes, dtype) two operands contraction, einsum, bmm lowerings in both operand 
+/// orders and tensordot are timed, the fastest one is then used for the following calls.
+/// Contractions along the path of three operands or more are tuned step by step.
+/// @param enabled true to enable the autotuner
+inline void set_einsum_autotune(bool enabled)
+{
+	implementation::_update_einsum_options([&](auto&& options) { options.autotune = enabled; });
+}
+
+/// @brief Selects how einsum contracts pairs of operands when the autotuner is disabled.
+/// @param engine "backend" (default) forwards to the backend einsum, "ttgt" lowers every
+/// contraction it can to transpositions around a single (batched) matrix product,
+/// skipping the transpositions of operands already laid out for it.
+inline void set_einsum_engine(std::string const& engine)
+{
+	using namespace implementation;
+	if (!contains(_einsum_engines, engine))
+		throw Exception(format("Unknown einsum engine {}. Expect one of {}.", engine, print(_einsum_engines)));
+	_update_einsum_options([&](auto&& options) { options.engine = engine == "ttgt" ? EinsumEngine::ttgt : EinsumEngine::backend; });
+}
+
+/// @brief Decision table of the einsum autotuner, for inspection.
+/// @return map of "equation lhs_shape rhs_shape dtype device" keys to the chosen lowering and timings (none when einsum is the only candidate).
+inline auto einsum_autotune_decisions() -> std::map<std::string, implementation::EinsumDecision>
+{
+	std::lock_guard<std::mutex> lock(implementation::_einsumAutotuneMutex);
+	return implementation::_einsumAutotuneTable;
+}
+
+/// @brief Caps the size of the intermediate tensors created by einsum when it
+/// contracts three or more operands pairwise along an optimized path.
+/// @param limit maximum number of elements of an intermediate, std::nullopt for no limit
+inline void set_einsum_memory_limit(std::optional<int64_t> const& limit)
+{
+	implementation::_update_einsum_options([&](auto&& options) { options.memory_limit = limit; });
+}
+
+/// @brief Empties the recipe caches shared by all threads, recipes copied by each
+/// thread for its hottest patterns are dropped as well. Constant einsum contractions are kept.
+inline void clear_caches()
+{
+	using namespace implementation;
+	_transformRecipeCache.clear();
+	_reconstructFromShapeCache.clear();
+	_inverseRecipeCache.clear();
+	_einsumRecipeCache.clear();
+	_batchedEinsumRecipeCache.clear();
+	_contractionPathCache.clear();
+	_gemmLoweringCache.clear();
+}
+
+/// @brief Sets the capacity of the caches of transformation recipes (by pattern and rank)
+/// and of recipes cooked for input shapes, their entries beyond it are evicted.
+/// @param transform_recipes maximum number of recipes by pattern, 256 by default
+/// @param cooked_recipes maximum number of recipes by input shape, 1024 by default
+inline void set_recipe_cache_sizes(size_t transform_recipes, size_t cooked_recipes)
+{
+	using namespace implementation;
+	_transformRecipeCache.resize(transform_recipes);
+	_inverseRecipeCache.resize(transform_recipes);
+	_reconstructFromShapeCache.resize(cooked_recipes);
 }
 
 /// @brief Parse a tensor shape to dictionary mapping axes names to their lengths.
@@ -670,6 +1865,7 @@ inline auto parse_shape(Tensor const& tensor, std::string const& pattern)
 {
 	using namespace implementation;
 	auto exp = ParsedExpression(pattern, true);
+	exp.report_warnings();
 	auto [backend, _] = backends::get_backend(tensor);
 	Shape shape = backend.shape(tensor);
 	if (exp.has_composed_axes())
@@ -48,6 +48,25 @@ using CompositeAxes = std::vector<Axes>;
 using InputCompositeAxes = std::vector<std::tuple<Axes, Axes>>;
 using OutputCompositeAxes = std::vector<Axes>;
 
+// families of patterns having a dedicated (cheaper) execution path,
+// detected once when the recipe is prepared (see _apply_recipe)
+
+enum class KernelFamily
+{
+	generic,			// reshape, transpose, reduce, add axes, reshape
+	identity,			// "a b c -> a b c"
+	view,				// "a b c -> a (b c)", single reshape
+	transpose,			// "h w -> w h"
+	batched_transpose,	// "b h w -> b w h"
+	permute,			// "a b c -> c a b"
+	head_split,			// "b n (h d) -> b h n d", views only
+	head_merge,			// "b h n d -> b n (h d)"
+	pixel_shuffle,		// "b (c h2 w2) h w -> b c (h h2) (w w2)"
+	pixel_unshuffle,	// "b c (h h2) (w w2) -> b (c h2 w2) h w"
+	patchify,			// "b c (h p1) (w p2) -> b (h w) (p1 p2 c)"
+	unpatchify,			// "b (h w) (p1 p2 c) -> b c (h p1) (w p2)"
+};
+
 struct TransformRecipe
 {
 	Axes elementary_axes_lengths;
@@ -58,10 +77,20 @@ struct TransformRecipe
 	AxesMap added_axes;
 	OutputCompositeAxes output_composite_axes;
 	Hash hash{ 0 }; // trick for LRU cache
+	KernelFamily family{ KernelFamily::generic };
 };
 
 using MultiRecipe = std::map<int64_t, TransformRecipe>;
 
+struct EinsumRecipe
+{
+	std::string compact_pattern;				// torch-style pattern over the elementary axes
+	std::vector<CompositeAxes> input_groups;	// elementary axes of every input dimension
+	CompositeAxes output_groups;				// elementary axes of every output dimension
+	AxesNames axes_names;						// names of the elementary axes
+	bool needs_reshape{ false };				// composite or singleton () axes somewhere
+};
+
 using CookedRecipe = std::tuple<OptionalAxes, 
 							    OptionalAxes, 
 										Axes, 
@@ -145,6 +174,25 @@ inline auto print(std::set<std::string> const& ids) -> std::string
 	return "[" + join(values, ", ") + "]";
 }
 
+inline auto print(KernelFamily family) -> std::string
+{
+	switch (family)
+	{
+	case KernelFamily::identity:			return "identity";
+	case KernelFamily::view:				return "view";
+	case KernelFamily::transpose:			return "transpose";
+	case KernelFamily::batched_transpose:	return "batched_transpose";
+	case KernelFamily::permute:				return "permute";
+	case KernelFamily::head_split:			return "head_split";
+	case KernelFamily::head_merge:			return "head_merge";
+	case KernelFamily::pixel_shuffle:		return "pixel_shuffle";
+	case KernelFamily::pixel_unshuffle:		return "pixel_unshuffle";
+	case KernelFamily::patchify:			return "patchify";
+	case KernelFamily::unpatchify:			return "unpatchify";
+	default:								return "generic";
+	}
+}
+
 // few other helpers
 
 inline auto values(Identifiers const& identifiers) -> std::vector<int64_t>
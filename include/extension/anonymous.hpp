@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include <extension/exception.hpp>
 #include <extension/format.hpp>
 
@@ -79,11 +81,10 @@ private:
 	}
 
 private:
-	static uint64_t _UUID;
+	// patterns are parsed from any thread
+	static inline std::atomic<uint64_t> _UUID{ 0 };
 };
 
-uint64_t AnonymousAxis::_UUID { 0 };
-
 inline bool operator==(AnonymousAxis const& lhs, AnonymousAxis const& rhs)
 {
 	return lhs.uuid == rhs.uuid;
@@ -1,22 +1,38 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Shared by every thread of the process: each call locks, values are immutable and held
+// by shared pointers, so that an entry evicted by another thread stays alive for its readers.
+// find_local() first looks in a small direct-mapped cache of the calling thread, its hits
+// take no lock, write no shared memory and copy no value. Clearing or resizing the shared
+// cache bumps its epoch, which invalidates the pointers kept by every thread.
 
 template <typename key_t, typename value_t>
 class LRUCache
 {
 public:
-	typedef typename std::pair<key_t, value_t> key_value_pair_t;
+	typedef typename std::shared_ptr<const value_t> value_ptr_t;
+	typedef typename std::pair<key_t, value_ptr_t> key_value_pair_t;
 	typedef typename std::list<key_value_pair_t>::iterator list_iterator_t;
 
 	LRUCache(size_t max_size) 
 		: _max_size(max_size) 
+		, _id(_next_id()++)
 	{}
 	
-	void put(const key_t& key, const value_t& value) 
+	value_ptr_t put(const key_t& key, const value_t& value) 
 	{
+		auto pointer = std::make_shared<const value_t>(value);
+
+		std::lock_guard<std::mutex> lock(_mutex);
 		auto it = _cache_items_map.find(key);
-		_cache_items_list.push_front(key_value_pair_t(key, value));
+		_cache_items_list.push_front(key_value_pair_t(key, pointer));
 		if (it != _cache_items_map.end())
 		{
 			_cache_items_list.erase(it->second);
@@ -31,32 +47,108 @@ public:
 			_cache_items_map.erase(last->first);
 			_cache_items_list.pop_back();
 		}
+
+		return pointer;
 	}
 	
-	const value_t& get(const key_t& key) 
+	value_ptr_t get(const key_t& key) 
 	{
+		auto value = find(key);
+		if (!value)
+			throw std::range_error("There is no such key in cache");
+		return value;
+	}
+
+	// lookup and use in a single lock, an exists() then get() pair can be split by an eviction
+	value_ptr_t find(const key_t& key)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
 		auto it = _cache_items_map.find(key);
 		if (it == _cache_items_map.end())
-			throw std::range_error("There is no such key in cache");
-		else
+			return nullptr;
+
+		_cache_items_list.splice(_cache_items_list.begin(), _cache_items_list, it->second);
+		return it->second->second;
+	}
+	
+	value_ptr_t find_local(const key_t& key)
+	{
+		auto&& slot = _local_slots()[std::hash<key_t>()(key) % _n_local_slots];
+		auto epoch = _epoch.load(std::memory_order_acquire);
+		if (slot.value && slot.owner == _id && slot.epoch == epoch && slot.key == key)
+			return slot.value;
+
+		auto value = find(key);
+		if (value)
+			slot = { _id, epoch, key, value };
+		return value;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_cache_items_list.clear();
+		_cache_items_map.clear();
+		_epoch++;
+	}
+
+	void resize(size_t max_size)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_max_size = max_size;
+		while (_cache_items_map.size() > _max_size)
 		{
-			_cache_items_list.splice(_cache_items_list.begin(), _cache_items_list, it->second);
-			return it->second->second;
+			_cache_items_map.erase(_cache_items_list.back().first);
+			_cache_items_list.pop_back();
 		}
+		_epoch++;
 	}
-	
+
+	uint64_t epoch() const
+	{
+		return _epoch.load(std::memory_order_acquire);
+	}
+
 	bool exists(const key_t& key) const
 	{
+		std::lock_guard<std::mutex> lock(_mutex);
 		return _cache_items_map.find(key) != _cache_items_map.end();
 	}
 	
 	size_t size() const 
 	{
+		std::lock_guard<std::mutex> lock(_mutex);
 		return _cache_items_map.size();
 	}
 	
 private:
+	mutable std::mutex _mutex;
 	std::list<key_value_pair_t> _cache_items_list;
 	std::unordered_map<key_t, list_iterator_t> _cache_items_map;
 	size_t _max_size;
+	uint64_t _id;
+	std::atomic<uint64_t> _epoch{ 0 };
+
+	static constexpr size_t _n_local_slots = 64;
+
+	struct LocalSlot
+	{
+		uint64_t owner{ 0 };
+		uint64_t epoch{ 0 };
+		key_t key{};
+		value_ptr_t value;
+	};
+
+	// slots are shared by the caches of the same types, the owner tells them apart
+	static auto _local_slots() -> std::array<LocalSlot, _n_local_slots>&
+	{
+		static thread_local std::array<LocalSlot, _n_local_slots> slots;
+		return slots;
+	}
+
+	static auto _next_id() -> std::atomic<uint64_t>&
+	{
+		static std::atomic<uint64_t> id{ 1 };
+		return id;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <extension/iterators.hpp>
+
+namespace einops {
+namespace implementation {
+
+// Work-stealing thread pool: every worker owns a queue, pops its own tasks from
+// the back and steals from the front of the others when it runs out of work.
+// Threads waiting on a parallel_for run tasks as well, so nested calls can't deadlock.
+
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+	explicit ThreadPool(size_t n_threads = std::max(1u, std::thread::hardware_concurrency()))
+	{
+		for (auto _ : iters::range(n_threads))
+			_queues.push_back(std::make_unique<Queue>());
+
+		for (auto i : iters::range(n_threads))
+			_threads.emplace_back([this, i]() { work(i); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_wake.notify_all();
+
+		for (auto&& thread : _threads)
+			thread.join();
+	}
+
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	auto size() const -> size_t
+	{
+		return _threads.size();
+	}
+
+	// shared by the library, started on first use
+	static auto global() -> ThreadPool&
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	void submit(Task task)
+	{
+		// workers keep their subtasks local, other threads spread them round-robin
+		auto i = _worker == this ? _worker_index : _next++ % _queues.size();
+
+		_pending++;
+		{
+			std::lock_guard<std::mutex> lock(_queues[i]->mutex);
+			_queues[i]->tasks.push_back(std::move(task));
+		}
+		// a worker checking for work under the lock either sees the task or gets notified
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+		}
+		_wake.notify_one();
+	}
+
+	// calls function(i) for every i in [0, n), indices are grouped in a few ranges
+	// per thread, the first exception is rethrown once every index is done
+	template <typename Function>
+	void parallel_for(size_t n, Function&& function)
+	{
+		if (n == 0)
+			return;
+
+		auto n_ranges = std::min(n, 4 * (size() + 1));
+		auto step = (n + n_ranges - 1) / n_ranges;
+
+		std::atomic<size_t> remaining{ 0 };
+		std::exception_ptr error;
+		std::mutex error_mutex;
+
+		for (size_t start = 0; start < n; start += step)
+		{
+			remaining++;
+			auto stop = std::min(n, start + step);
+			submit([&, start, stop]()
+			{
+				try
+				{
+					for (auto i = start; i < stop; ++i)
+						function(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (!error)
+						error = std::current_exception();
+				}
+				remaining--;
+			});
+		}
+
+		while (remaining > 0)
+			if (!run_one())
+				std::this_thread::yield();
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> _queues;
+	std::vector<std::thread> _threads;
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::atomic<int64_t> _pending{ 0 };
+	std::atomic<size_t> _next{ 0 };
+	bool _stop{ false };
+
+	static inline thread_local ThreadPool* _worker = nullptr;
+	static inline thread_local size_t _worker_index = 0;
+
+	auto pop(size_t i, Task& task) -> bool
+	{
+		std::lock_guard<std::mutex> lock(_queues[i]->mutex);
+		if (_queues[i]->tasks.empty())
+			return false;
+		task = std::move(_queues[i]->tasks.back());
+		_queues[i]->tasks.pop_back();
+		_pending--;
+		return true;
+	}
+
+	auto steal(size_t i, Task& task) -> bool
+	{
+		std::lock_guard<std::mutex> lock(_queues[i]->mutex);
+		if (_queues[i]->tasks.empty())
+			return false;
+		task = std::move(_queues[i]->tasks.front());
+		_queues[i]->tasks.pop_front();
+		_pending--;
+		return true;
+	}
+
+	// own queue first, then the others starting from the next one
+	auto run_one() -> bool
+	{
+		auto first = _worker == this ? _worker_index : 0;
+
+		Task task;
+		auto found = _worker == this && pop(first, task);
+		for (size_t k = 0; !found && k < _queues.size(); ++k)
+			found = steal((first + k) % _queues.size(), task);
+
+		if (found)
+			task();
+		return found;
+	}
+
+	void work(size_t i)
+	{
+		_worker = this;
+		_worker_index = i;
+
+		while (true)
+		{
+			if (run_one())
+				continue;
+
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stop || _pending > 0; });
+			if (_stop && _pending <= 0)
+				return;
+		}
+	}
+};
+
+} // namespace implementation
+} // namespace einops
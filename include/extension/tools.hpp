@@ -6,6 +6,7 @@
 #include <cwctype>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <locale>
 #include <map>
 #include <numeric>
@@ -54,57 +55,6 @@ inline auto to_vector(const std::tuple<first_type, others...> &t)
         (t, std::make_index_sequence<s>{});
 }
 
-// Convert a vector<T> to initializer_list<T>
-// https://stackoverflow.com/questions/18895583/convert-a-vectort-to-initializer-listt
-
-namespace implementation {
-
-constexpr size_t DEFAULT_MAX_LENGTH = 128;
-
-template <typename V> struct backingValue { static V value; };
-template <typename V> V backingValue<V>::value;
-
-template <typename V, typename... Vcount> struct backingList { static std::initializer_list<V> list; };
-template <typename V, typename... Vcount>
-std::initializer_list<V> backingList<V, Vcount...>::list = { (Vcount)backingValue<V>::value... };
-
-template <size_t maxLength, typename It, typename V = typename It::value_type, typename... Vcount>
-static typename std::enable_if< sizeof...(Vcount) >= maxLength,
-	std::initializer_list<V> >::type generate_n(It begin, It end, It current)
-{
-	throw std::length_error("More than maxLength elements in range.");
-}
-
-template <size_t maxLength = DEFAULT_MAX_LENGTH, typename It, typename V = typename It::value_type, typename... Vcount>
-static typename std::enable_if < sizeof...(Vcount) < maxLength,
-	std::initializer_list<V> > ::type generate_n(It begin, It end, It current)
-{
-	if (current != end)
-		return generate_n<maxLength, It, V, V, Vcount...>(begin, end, ++current);
-
-	current = begin;
-	for (auto it = backingList<V, Vcount...>::list.begin();
-		it != backingList<V, Vcount...>::list.end();
-		++current, ++it)
-		*const_cast<V*>(&*it) = *current;
-
-	return backingList<V, Vcount...>::list;
-}
-
-} // namespace implementation
-
-template <typename Iterator>
-inline auto to_initializer_list(Iterator begin, Iterator end) -> std::initializer_list<typename Iterator::value_type>
-{
-	return implementation::generate_n(begin, end, begin);
-}
-
-template <typename Type>
-inline auto to_initializer_list(std::vector<Type> const& vector) -> std::initializer_list<Type>
-{
-	return to_initializer_list(vector.begin(), vector.end());
-}
-
 template<class T, class... Rest>
 inline constexpr bool are_all_same = (std::is_same_v<T, Rest> && ...);
 
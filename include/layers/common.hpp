@@ -1,10 +1,112 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+
 #include <einops.hpp>
 
 namespace einops {
 namespace implementation {
 
+// Recipes cooked by a layer for the shapes of its inputs. A module mostly sees the
+// same shape call after call, so the last entry is read with a single atomic load,
+// other shapes go through a small LRU cache under a lock.
+
+struct CookedRecipeEntry
+{
+	Shape shape;
+	TransformRecipe recipe;
+	CookedRecipe cooked;
+};
+
+template <typename Value>
+class ShapeCache
+{
+public:
+	using Entry = Value;
+
+	explicit ShapeCache(size_t max_size = 16)
+		: _entries(max_size)
+	{}
+
+	template <typename Cook>
+	auto get(Shape const& shape, Cook&& cook) -> std::shared_ptr<Entry const>
+	{
+		auto last = std::atomic_load(&_last);
+		if (last && compare<int64_t>(last->shape, shape))
+			return last;
+
+		std::shared_ptr<Entry const> entry;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto hash = HashBuilder()(print(shape));
+			auto cached = _entries.find(hash);
+			if (cached && compare<int64_t>(cached->shape, shape))
+				entry = cached;
+			else
+				entry = _entries.put(hash, cook(shape));
+		}
+
+		std::atomic_store(&_last, entry);
+		return entry;
+	}
+
+private:
+	std::shared_ptr<Entry const> _last;
+	std::mutex _mutex;
+	LRUCache<Hash, Entry> _entries;
+};
+
+using CookedRecipeCache = ShapeCache<CookedRecipeEntry>;
+
+// Recipes of a layer for every number of input dimensions, each of them prepared
+// the first time an input of that rank comes, so building a layer costs nothing
+
+class LayerRecipes
+{
+public:
+	LayerRecipes(Pattern const& pattern, Reduction const& reduction, AxesLengths const& axes_lengths)
+		: _pattern(pattern)
+		, _reduction(reduction)
+		, _axes_lengths(axes_lengths)
+	{}
+
+	// references stay valid, map nodes never move
+	auto get(int64_t ndim) -> TransformRecipe const&
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _recipes.find(ndim);
+		if (it == _recipes.end())
+			it = _recipes.emplace(ndim, *_prepare_transformation_recipe(_pattern, _reduction, _axes_lengths, ndim)).first;
+		return it->second;
+	}
+
+private:
+	Pattern _pattern;
+	Reduction _reduction;
+	AxesLengths _axes_lengths;
+	std::mutex _mutex;
+	MultiRecipe _recipes;
+};
+
+inline auto _cook_layer_recipe(LayerRecipes& recipes, Shape const& shape, AxesLengths const& axes_lengths, std::string const& layer)
+	-> CookedRecipeCache::Entry
+{
+	try
+	{
+		auto&& recipe = recipes.get(shape.size());
+		return { shape, recipe, _reconstruct_from_shape_uncached(recipe, shape, axes_lengths) };
+	}
+	catch (Exception const& e)
+	{
+		throw Exception(format(" Error while applying {} to input of shape {}\n {}", layer, print(shape), e.what()));
+	}
+}
+
 template <typename Tensor>
 class RearrangeMixin
 {
@@ -12,40 +114,39 @@ public:
 	template <typename... Args>
 	RearrangeMixin(Pattern const& pattern, Args... axes_lengths)
 		: _pattern(pattern)
-	{
-		_multirecipe = multirecipe();
-		_axes_lengths = to_vector(std::tuple<Args...>(axes_lengths...));
-	}
+		, _axes_lengths(_hashable_axes_lengths(axes_lengths...))
+		, _recipes(pattern, "rearrange", _axes_lengths)
+	{}
 
-	MultiRecipe multirecipe() const
+	// repeated shapes only run the backend calls of their cooked recipe
+	virtual Tensor _apply_recipe(Tensor const& x)
 	{
-		try
-		{
-			return ::_prepare_recipes_for_all_dims(_pattern, "rearrange", _axes_lengths);
-		}
-		catch (Exception const& e)
-		{
-			throw Exception(format(" Error while preparing {}\n {}", to_string(), e.what()));
-		}
+		auto [backend, tensor] = backends::get_backend(x);
+		auto entry = cooked_entry(backend.shape(tensor));
+		return _apply_cooked_recipe(backend, entry->recipe, entry->cooked, tensor, "rearrange");
 	}
 
-	virtual Tensor _apply_recipe(Tensor const& x)
+	auto cooked_entry(Shape const& shape) -> std::shared_ptr<CookedRecipeCache::Entry const>
 	{
-		return ::_apply_recipe(get_backend(x), _multirecipe[x.sizes()], x, "rearrange", _axes_lengths);
+		return _cooked.get(shape, [this](Shape const& shape)
+		{
+			return _cook_layer_recipe(_recipes, shape, _axes_lengths, to_string());
+		});
 	}
 
 	std::string to_string() const
 	{
 		std::string params = _pattern;
 		for (auto&& [axis, length] : _axes_lengths)
-			params += format(", {}={}", print(axis), print(length));
-		return format("{}({})", "RearrangeMixin", params);
+			params += format(", {}={}", axis, print(length));
+		return format("RearrangeMixin({})", params);
 	}
 
 protected:
 	Pattern _pattern;
-	MultiRecipe _multirecipe;
 	AxesLengths _axes_lengths;
+	LayerRecipes _recipes;
+	CookedRecipeCache _cooked;
 };
 
 template <typename Tensor>
@@ -56,42 +157,187 @@ public:
 	ReduceMixin(Pattern const& pattern, Reduction const& reduction, Args... axes_lengths)
 		: _pattern(pattern)
 		, _reduction(reduction)
+		, _axes_lengths(_hashable_axes_lengths(axes_lengths...))
+		, _recipes(pattern, reduction, _axes_lengths)
+	{}
+
+	// repeated shapes only run the backend calls of their cooked recipe
+	virtual Tensor _apply_recipe(Tensor const& x)
 	{
-		_multirecipe = multirecipe();
-		_axes_lengths = to_vector(std::tuple<Args...>(axes_lengths...));
+		auto [backend, tensor] = backends::get_backend(x);
+		auto entry = cooked_entry(backend.shape(tensor));
+		return _apply_cooked_recipe(backend, entry->recipe, entry->cooked, tensor, _reduction);
 	}
 
-	MultiRecipe multirecipe() const
+	auto cooked_entry(Shape const& shape) -> std::shared_ptr<CookedRecipeCache::Entry const>
 	{
-		try
-		{
-			return ::_prepare_recipes_for_all_dims(_pattern, _reduction, _axes_lengths);
-		}
-		catch (Exception const& e)
+		return _cooked.get(shape, [this](Shape const& shape)
 		{
-			throw Exception(format(" Error while preparing {}\n {}", to_string(), e.what()));
-		}
+			return _cook_layer_recipe(_recipes, shape, _axes_lengths, to_string());
+		});
 	}
 
-	virtual Tensor _apply_recipe(Tensor const& x)
+	auto reduction() const -> Reduction const&
 	{
-		return ::_apply_recipe(get_backend(x), _multirecipe[x.ndimension()], x, _reduction, _axes_lengths);
+		return _reduction;
 	}
 
 	std::string to_string() const
 	{
 		std::string params = format("{}, {}", _pattern, _reduction);
 		for (auto&& [axis, length] : _axes_lengths)
-			params += format(", {}={}", print(axis), print(length));
-		return format("{}({})", "ReduceMixin", params);
+			params += format(", {}={}", axis, print(length));
+		return format("ReduceMixin({})", params);
 	}
 
 protected:
 	Pattern _pattern;
 	Reduction _reduction;
-	MultiRecipe _multirecipe;
 	AxesLengths _axes_lengths;
+	LayerRecipes _recipes;
+	CookedRecipeCache _cooked;
+};
+
+// Layers of a chain applied as one: the cooked recipes of the layers, each for the output
+// shape of the previous one, are composed for the shape of the input. Axes of the input are
+// split into the common refinement of the elementary axes of every layer, so the chain is a
+// reshape, a permutation, a reduction and a reshape. Composition fails when a layer splits
+// a merged axis across the boundaries of the axes it was merged from, e.g. (h w) as (w h).
+
+struct FusedStage
+{
+	std::function<std::shared_ptr<CookedRecipeEntry const>(Shape const&)> cooked_entry;
+	Reduction reduction;
+	std::string description;
 };
 
+// rearrangements can go along with a single kind of reduction, reducing in one go
+// the axes reduced by several layers gives the same result
+inline auto _reduction_of_fused_stages(std::vector<FusedStage> const& stages) -> std::optional<Reduction>
+{
+	Reduction reduction = "rearrange";
+	for (auto&& stage : stages)
+	{
+		if (stage.reduction == "repeat")
+			return std::nullopt;
+		if (stage.reduction == "rearrange")
+			continue;
+		if (reduction != "rearrange" && reduction != stage.reduction)
+			return std::nullopt;
+		reduction = stage.reduction;
+	}
+	return reduction;
+}
+
+inline auto _fuse_cooked_recipes(std::vector<FusedStage> const& stages, Shape const& shape) -> std::optional<CookedRecipe>
+{
+	if (contains(shape, int64_t(0)))
+		return std::nullopt;
+
+	// axes of the fused recipe: their lengths, their order in the input, the order
+	// of the kept ones after the layers applied so far, and the reduced ones
+	Shape lengths;
+	Axes input_order, order, reduced;
+	for (auto length : shape)
+	{
+		if (length == 1)
+			continue;
+		input_order.push_back(lengths.size());
+		order.push_back(lengths.size());
+		lengths.push_back(length);
+	}
+
+	auto stage_shape = shape;
+	for (auto&& stage : stages)
+	{
+		auto entry = stage.cooked_entry(stage_shape);
+		auto&& [init_shapes, axes_reordering, reduced_axes, added_axes, final_shapes, _] = entry->cooked;
+		if (!added_axes.empty())
+			return std::nullopt;
+
+		// fused axes covered by each elementary axis of the layer, split where needed
+		auto elementary = init_shapes.value_or(stage_shape);
+		std::vector<Axes> groups;
+		size_t cursor = 0;
+		for (auto length : elementary)
+		{
+			Axes group;
+			for (; length > 1; ++cursor)
+			{
+				auto axis = order[cursor];
+				if (lengths[axis] > length)
+				{
+					if (lengths[axis] % length != 0)
+						return std::nullopt;
+
+					// the outer part stays in place of the axis, the inner one follows it
+					auto inner = Axis(lengths.size());
+					lengths.push_back(lengths[axis] / length);
+					lengths[axis] = length;
+					input_order.insert(std::find(input_order.begin(), input_order.end(), axis) + 1, inner);
+					order.insert(order.begin() + cursor + 1, inner);
+				}
+
+				if (length % lengths[axis] != 0)
+					return std::nullopt;
+
+				length /= lengths[axis];
+				group.push_back(axis);
+			}
+			groups.push_back(group);
+		}
+
+		auto permutation = axes_reordering.value_or(iters::range<Axis>(elementary.size()).vec());
+		auto n_kept = permutation.size() - reduced_axes.size();
+
+		Shape kept_shape;
+		order.clear();
+		for (auto&& [i, axis] : iters::enumerate(permutation))
+		{
+			for (auto fused_axis : groups[axis])
+				(i < n_kept ? order : reduced).push_back(fused_axis);
+			if (i < n_kept)
+				kept_shape.push_back(elementary[axis]);
+		}
+
+		stage_shape = final_shapes.value_or(kept_shape);
+	}
+
+	Axes positions (lengths.size());
+	Shape init_shape;
+	for (auto&& [position, axis] : iters::enumerate(input_order))
+	{
+		positions[axis] = position;
+		init_shape.push_back(lengths[axis]);
+	}
+
+	Axes permutation;
+	Shape kept_shape;
+	for (auto axis : order)
+	{
+		permutation.push_back(positions[axis]);
+		kept_shape.push_back(lengths[axis]);
+	}
+	for (auto axis : reduced)
+		permutation.push_back(positions[axis]);
+
+	auto n_axes = Axis(permutation.size());
+	Axes reduced_axes = iters::range<Axis>(order.size(), n_axes).vec();
+
+	OptionalAxes init_shapes = init_shape;
+	if (compare<int64_t>(init_shape, shape))
+		init_shapes = std::nullopt;
+
+	OptionalAxes axes_reordering = permutation;
+	if (compare<Axis>(permutation, iters::range<Axis>(n_axes).vec()))
+		axes_reordering = std::nullopt;
+
+	OptionalAxes final_shapes = stage_shape;
+	if (compare<int64_t>(stage_shape, kept_shape))
+		final_shapes = std::nullopt;
+
+	return CookedRecipe{ init_shapes, axes_reordering, reduced_axes, AxesMap(), final_shapes, n_axes };
+}
+
 } // namespace implementation
 } // namespace einops
\ No newline at end of file
@@ -1,27 +1,256 @@
 #pragma once
 
+#include <cmath>
+
 #include <einops.hpp>
 
 namespace einops {
 namespace implementation {
 
+// Contraction of an EinMix layer as a single matrix product. Output axes found in the
+// input and the weight are batch axes, the other output axes are m (from the input)
+// or n (from the weight) axes, and input axes missing in the output are contracted k
+// axes. The weight is stored as [batch..., k..., n...], so its matrix is a view.
+
+struct EinMixLowering
+{
+	Axes input_permutation;		// flat input axes to [batch..., m..., k...]
+	Axes output_permutation;	// from [batch..., m..., n...] to flat output axes
+	Axes bias_permutation;		// from flat output axes to [batch..., m..., n...]
+	Shape bias_shape;			// bias broadcast to [batch..., 1..., n...]
+	Shape n_shape;
+	int64_t n_batch_axes{ 0 };
+	int64_t n_m_axes{ 0 };
+	int64_t batch_length{ 1 };
+	int64_t k_length{ 1 };
+	int64_t n_length{ 1 };
+	bool input_in_layout{ false };	// no permutation needed
+	bool output_in_layout{ false };
+	bool bias_fused{ false };		// bias only spans batch and n axes, added by the product
+	bool is_gemm{ false };			// false when input axes are summed without the weight
+	std::string einsum_pattern;		// fallback over flat axes, weight in stored order
+};
+
 class _EinmixMixin
 {
 public:
+	/// @param pattern transformation pattern, left side - dimensions of input, right side - dimensions of output
+	/// @param weight_shape axes of weight, a tensor with these dimensions is created
+	/// @param bias_shape axes of bias, empty for no bias
+	/// @param axes_lengths dimensions of weight and bias axes
 	template <typename... Args>
 	_EinmixMixin(Pattern const& pattern, std::string const& weight_shape, std::string const& bias_shape, Args... axes_lengths)
-	{}
+		: _pattern(pattern)
+		, _weight_shape(weight_shape)
+		, _bias_shape(bias_shape)
+		, _axes_lengths(_hashable_axes_lengths(axes_lengths...))
+	{
+		try
+		{
+			prepare();
+		}
+		catch (Exception const& e)
+		{
+			throw Exception(format(" Error while preparing {}\n {}", to_string(), e.what()));
+		}
+	}
+
+	virtual ~_EinmixMixin() = default;
 
 	virtual void _create_rearrange_layers(std::optional<Pattern> const& pre_reshape_pattern,
-										  std::optional<AxesMap> const& pre_reshape_lengths,
+										  std::optional<AxesLengthsMap> const& pre_reshape_lengths,
 										  std::optional<Pattern> const& post_reshape_pattern,
-										  std::optional<AxesMap> const& post_reshape_lengths) = 0;
+										  std::optional<AxesLengthsMap> const& post_reshape_lengths) = 0;
 
-	virtual void _create_parameters() = 0;
+	virtual void _create_parameters(Shape const& weight_shape, double weight_bound, std::optional<Shape> const& bias_shape, double bias_bound) = 0;
 
 	std::string to_string() const
 	{
-		return "";
+		std::string params = format("'{}', weight_shape='{}'", _pattern, _weight_shape);
+		if (!_bias_shape.empty())
+			params += format(", bias_shape='{}'", _bias_shape);
+		for (auto&& [axis, length] : _axes_lengths)
+			params += format(", {}={}", axis, print(length));
+		return format("EinMix({})", params);
+	}
+
+	/// @brief weight axes in the order they are stored, batch axes first, then contracted and output ones
+	auto weight_layout() const -> AxesNames const& { return _weight_layout; }
+
+protected:
+	Pattern _pattern;
+	std::string _weight_shape;
+	std::string _bias_shape;
+	AxesLengths _axes_lengths;
+
+	std::optional<Pattern> _pre_reshape_pattern;
+	AxesLengthsMap _pre_reshape_lengths;
+	std::optional<Pattern> _post_reshape_pattern;
+	Shape _weight_parameter_shape;
+	std::optional<Shape> _bias_parameter_shape;
+	double _weight_bound{ 0 };
+	double _bias_bound{ 0 };
+	AxesNames _weight_layout;
+	EinMixLowering _lowering;
+
+	// layers call this from their constructor, the mixin can't call virtuals from its own
+	void _create_layers_and_parameters()
+	{
+		_create_rearrange_layers(_pre_reshape_pattern, _pre_reshape_lengths, _post_reshape_pattern, AxesLengthsMap());
+		_create_parameters(_weight_parameter_shape, _weight_bound, _bias_parameter_shape, _bias_bound);
+	}
+
+private:
+	static auto flat_axes(ParsedExpression const& expression) -> AxesNames
+	{
+		AxesNames names;
+		for (auto&& group : expression.composition)
+			for (auto&& name : std::get<0>(group))
+				names.push_back(name);
+		return names;
+	}
+
+	static auto has_composed_axes(ParsedExpression const& expression) -> bool
+	{
+		return std::any_of(expression.composition.begin(), expression.composition.end(), [](auto&& group) { return std::get<0>(group).size() != 1; });
+	}
+
+	static void report_axes(AxesNames const& axes, AxesNames const& allowed, std::string const& message)
+	{
+		AxesNames unknown;
+		for (auto&& axis : axes)
+			if (!contains(allowed, axis))
+				unknown.push_back(axis);
+		if (!unknown.empty())
+			throw Exception(format(message, print(unknown)));
+	}
+
+	static auto positions(AxesNames const& axes, AxesNames const& names) -> Axes
+	{
+		Axes output;
+		for (auto&& name : names)
+			output.push_back(index(axes, name));
+		return output;
+	}
+
+	void prepare()
+	{
+		auto&& [left_pattern, right_pattern] = divide(_pattern, "->");
+		auto left = ParsedExpression(left_pattern);
+		auto right = ParsedExpression(right_pattern);
+		auto weight = ParsedExpression(_weight_shape);
+		for (auto&& expression : { &left, &right, &weight })
+			expression->report_warnings();
+
+		if (left.has_ellipsis || right.has_ellipsis || weight.has_ellipsis)
+			throw Exception("Ellipsis is not supported in EinMix (right now)");
+		if (left.has_non_unitary_anonymous_axes || right.has_non_unitary_anonymous_axes || weight.has_non_unitary_anonymous_axes)
+			throw Exception("Anonymous axes (numbers) are not allowed in EinMix");
+		if (contains(_weight_shape, '(') || contains(_weight_shape, ')'))
+			throw Exception(format("Parenthesis is not allowed in weight shape: {}", _weight_shape));
+
+		auto left_axes = flat_axes(left);
+		auto right_axes = flat_axes(right);
+		auto weight_axes = flat_axes(weight);
+
+		AxesLengthsMap lengths;
+		for (auto&& [axis, length] : _axes_lengths)
+			lengths[axis] = length;
+
+		AxesNames axes_names;
+		for (auto&& [axis, length] : _axes_lengths)
+			axes_names.push_back(axis);
+
+		auto left_and_weight = left_axes;
+		left_and_weight.insert(left_and_weight.end(), weight_axes.begin(), weight_axes.end());
+		auto left_and_right = left_axes;
+		left_and_right.insert(left_and_right.end(), right_axes.begin(), right_axes.end());
+
+		report_axes(right_axes, left_and_weight, "Unrecognized identifiers on the right side of EinMix {}");
+
+		if (has_composed_axes(left))
+		{
+			_pre_reshape_pattern = format("{}->{}", left_pattern, join(left_axes, " "));
+			for (auto&& [axis, length] : lengths)
+				if (contains(left_axes, axis))
+					_pre_reshape_lengths[axis] = length;
+		}
+		if (has_composed_axes(right))
+			_post_reshape_pattern = format("{}->{}", join(right_axes, " "), right_pattern);
+
+		for (auto&& axis : weight_axes)
+			if (!lengths.count(axis))
+				throw Exception(format("Dimension {} of weight should be specified", axis));
+		report_axes(axes_names, left_and_weight, "Axes {} are not used in pattern");
+		report_axes(weight_axes, left_and_right, "Weight axes {} are redundant");
+
+		AxesNames batch, m, n, k, summed;
+		for (auto&& axis : right_axes)
+			(contains(left_axes, axis) ? (contains(weight_axes, axis) ? batch : m) : n).push_back(axis);
+		for (auto&& axis : left_axes)
+			if (!contains(right_axes, axis))
+				(contains(weight_axes, axis) ? k : summed).push_back(axis);
+
+		auto length_of = [&](AxesNames const& axes)
+		{
+			int64_t length = 1;
+			for (auto&& axis : axes)
+				length *= lengths.at(axis);
+			return length;
+		};
+
+		_weight_layout = batch;
+		_weight_layout.insert(_weight_layout.end(), k.begin(), k.end());
+		_weight_layout.insert(_weight_layout.end(), n.begin(), n.end());
+		for (auto&& axis : _weight_layout)
+			_weight_parameter_shape.push_back(lengths.at(axis));
+
+		auto fan_in = length_of(k);
+		_weight_bound = std::sqrt(3. / fan_in);
+		_bias_bound = std::sqrt(1. / fan_in);
+
+		AxesNames bias_axes;
+		if (!_bias_shape.empty())
+		{
+			bias_axes = flat_axes(ParsedExpression(_bias_shape));
+			report_axes(bias_axes, right_axes, "Bias axes {} not present in output");
+			report_axes(bias_axes, axes_names, "Sizes not provided for bias axes {}");
+
+			_bias_parameter_shape = Shape();
+			for (auto&& axis : right_axes)
+				_bias_parameter_shape->push_back(contains(bias_axes, axis) ? lengths.at(axis) : 1);
+		}
+
+		auto is_identity = [](Axes const& permutation)
+		{
+			return compare<Axis>(permutation, iters::range<Axis>(permutation.size()).vec());
+		};
+
+		auto input_layout = batch;
+		input_layout.insert(input_layout.end(), m.begin(), m.end());
+		input_layout.insert(input_layout.end(), k.begin(), k.end());
+		auto product_layout = batch;
+		product_layout.insert(product_layout.end(), m.begin(), m.end());
+		product_layout.insert(product_layout.end(), n.begin(), n.end());
+
+		auto&& lowering = _lowering;
+		lowering.is_gemm = summed.empty();
+		lowering.input_permutation = positions(left_axes, input_layout);
+		lowering.output_permutation = positions(product_layout, right_axes);
+		lowering.bias_permutation = positions(right_axes, product_layout);
+		lowering.input_in_layout = is_identity(lowering.input_permutation);
+		lowering.output_in_layout = is_identity(lowering.output_permutation);
+		lowering.n_batch_axes = batch.size();
+		lowering.n_m_axes = m.size();
+		lowering.batch_length = length_of(batch);
+		lowering.k_length = length_of(k);
+		lowering.n_length = length_of(n);
+		for (auto&& axis : n)
+			lowering.n_shape.push_back(lengths.at(axis));
+		for (auto&& axis : product_layout)
+			lowering.bias_shape.push_back(contains(m, axis) ? 1 : lengths.at(axis));
+		lowering.bias_fused = std::none_of(bias_axes.begin(), bias_axes.end(), [&](auto&& axis) { return contains(m, axis); });
+		lowering.einsum_pattern = format("{}, {} -> {}", join(left_axes, " "), join(_weight_layout, " "), join(right_axes, " "));
 	}
 };
 
@@ -4,6 +4,8 @@
 
 #include <layers/common.hpp>
 #include <layers/einmix.hpp>
+#include <autograd.hpp>
+#include <torchops.hpp>
 using namespace einops;
 using namespace einops::backends;
 using namespace einops::implementation;
@@ -23,14 +25,16 @@ public:
 
 	virtual ~RearrangeImpl() throw() {}
 
+	// a single autograd node when trained, see RecipeFunction, and a single
+	// einops::rearrange node when traced with the operators registered
 	torch::Tensor forward(torch::Tensor input)
 	{
-		auto&& recipe = Base::_multirecipe[input.ndimension()];
-		apply_for_scriptable_torch(recipe, input, "rearrange", Base::_axes_lengths);
-		return input;
-	}
+		if (_traces_torch_ops())
+			return _call_rearrange_op(input, Base::_pattern, _torch_op_axes_lengths(Base::_axes_lengths));
 
-	torch::Tensor _apply_recipe(torch::Tensor const& x) final {}
+		auto entry = Base::cooked_entry(input.sizes().vec());
+		return _apply_cooked_recipe_with_grad(entry->recipe, entry->cooked, input, "rearrange");
+	}
 };
 
 TORCH_MODULE(Rearrange);
@@ -48,14 +52,16 @@ public:
 
 	virtual ~ReduceImpl() throw() {}
 
+	// a single autograd node when trained, see RecipeFunction, and a single
+	// einops::reduce node when traced with the operators registered
 	torch::Tensor forward(torch::Tensor input)
 	{
-		auto&& recipe = Base::_multirecipe[input.ndimension()];
-		apply_for_scriptable_torch(recipe, input, Base::_reduction, Base::_axes_lengths);
-		return input;
-	}
+		if (_traces_torch_ops())
+			return _call_reduce_op(input, Base::_pattern, Base::_reduction, _torch_op_axes_lengths(Base::_axes_lengths));
 
-	torch::Tensor _apply_recipe(torch::Tensor const& x) final {}
+		auto entry = Base::cooked_entry(input.sizes().vec());
+		return _apply_cooked_recipe_with_grad(entry->recipe, entry->cooked, input, Base::_reduction);
+	}
 };
 
 TORCH_MODULE(Reduce);
@@ -67,14 +73,230 @@ public:
 	template <typename... Args>
 	EinMixImpl(Pattern const& pattern, std::string const& weight_shape, std::string const& bias_shape, Args... axes_lengths)
 		: _EinmixMixin(pattern, weight_shape, bias_shape, axes_lengths...)
-	{}
+	{
+		_create_layers_and_parameters();
+	}
 
 	virtual ~EinMixImpl() throw() {}
 
+	// a view, one (batched) matrix product with the bias added by it, and a view
 	torch::Tensor forward(torch::Tensor x)
-	{}
+	{
+		if (_pre_rearrange)
+			x = _pre_rearrange->forward(x);
+
+		auto result = _lowering.is_gemm ? contract(x) : einsum(_lowering.einsum_pattern, x, _weight);
+		if (_bias.defined() && !(_lowering.is_gemm && _lowering.bias_fused))
+			result = result + _bias;
+
+		if (_post_rearrange)
+			result = _post_rearrange->forward(result);
+		return result;
+	}
+
+	/// @brief weight, stored with the axes of weight_layout()
+	auto weight() const -> torch::Tensor const& { return _weight; }
+
+	/// @brief bias, undefined without bias shape
+	auto bias() const -> torch::Tensor const& { return _bias; }
+
+	void _create_rearrange_layers(std::optional<Pattern> const& pre_reshape_pattern,
+								  std::optional<AxesLengthsMap> const& pre_reshape_lengths,
+								  std::optional<Pattern> const& post_reshape_pattern,
+								  std::optional<AxesLengthsMap> const& post_reshape_lengths) final
+	{
+		if (pre_reshape_pattern.has_value())
+			_pre_rearrange = register_module("pre_rearrange", std::make_shared<RearrangeImpl>(pre_reshape_pattern.value(), pre_reshape_lengths.value_or(AxesLengthsMap())));
+		if (post_reshape_pattern.has_value())
+			_post_rearrange = register_module("post_rearrange", std::make_shared<RearrangeImpl>(post_reshape_pattern.value(), post_reshape_lengths.value_or(AxesLengthsMap())));
+	}
+
+	void _create_parameters(Shape const& weight_shape, double weight_bound, std::optional<Shape> const& bias_shape, double bias_bound) final
+	{
+		_weight = register_parameter("weight", torch::nn::init::uniform_(torch::empty(weight_shape), -weight_bound, weight_bound));
+		if (bias_shape.has_value())
+			_bias = register_parameter("bias", torch::nn::init::uniform_(torch::empty(bias_shape.value()), -bias_bound, bias_bound));
+	}
+
+private:
+	std::shared_ptr<RearrangeImpl> _pre_rearrange;
+	std::shared_ptr<RearrangeImpl> _post_rearrange;
+	torch::Tensor _weight;
+	torch::Tensor _bias;
+
+	auto contract(torch::Tensor x) const -> torch::Tensor
+	{
+		auto&& lowering = _lowering;
+		if (!lowering.input_in_layout)
+			x = x.permute(lowering.input_permutation);
+
+		auto shape = x.sizes().vec();
+		Shape product_shape (shape.begin(), shape.begin() + lowering.n_batch_axes + lowering.n_m_axes);
+		auto m_length = prod(Shape(product_shape.begin() + lowering.n_batch_axes, product_shape.end()));
+		product_shape.insert(product_shape.end(), lowering.n_shape.begin(), lowering.n_shape.end());
+
+		auto fused = _bias.defined() && lowering.bias_fused;
+		auto bias = fused ? _bias.permute(lowering.bias_permutation).expand(lowering.bias_shape) : torch::Tensor();
+
+		torch::Tensor product;
+		if (lowering.n_batch_axes == 0)
+		{
+			auto lhs = x.reshape({ m_length, lowering.k_length });
+			auto rhs = _weight.view({ lowering.k_length, lowering.n_length });
+			product = fused ? torch::addmm(bias.reshape({ lowering.n_length }), lhs, rhs) : torch::mm(lhs, rhs);
+		}
+		else
+		{
+			auto lhs = x.reshape({ lowering.batch_length, m_length, lowering.k_length });
+			auto rhs = _weight.view({ lowering.batch_length, lowering.k_length, lowering.n_length });
+			product = fused ? torch::baddbmm(bias.reshape({ lowering.batch_length, 1, lowering.n_length }), lhs, rhs) : torch::bmm(lhs, rhs);
+		}
+
+		auto result = product.view(product_shape);
+		if (!lowering.output_in_layout)
+			result = result.permute(lowering.output_permutation);
+		return result;
+	}
 };
 
 TORCH_MODULE(EinMix);
 
+// Adjacent Rearrange and Reduce layers applied as one, see _fuse_cooked_recipes. Shapes
+// for which the recipes can't be composed go through the layers one after another.
+class FusedRecipeImpl : public torch::nn::Module
+{
+public:
+	explicit FusedRecipeImpl(std::vector<FusedStage> stages)
+		: _stages(std::move(stages))
+	{
+		auto reduction = _reduction_of_fused_stages(_stages);
+		if (!reduction.has_value())
+			throw Exception(format("Layers can't be fused: {}", to_string()));
+		_reduction = reduction.value();
+	}
+
+	virtual ~FusedRecipeImpl() throw() {}
+
+	torch::Tensor forward(torch::Tensor input)
+	{
+		auto entry = _cooked.get(input.sizes().vec(), [this](Shape const& shape)
+		{
+			return Entry{ shape, _fuse_cooked_recipes(_stages, shape) };
+		});
+
+		if (entry->cooked.has_value())
+			return _apply_cooked_recipe_with_grad(_recipe, entry->cooked.value(), input, _reduction);
+
+		for (auto&& stage : _stages)
+		{
+			auto stage_entry = stage.cooked_entry(input.sizes().vec());
+			input = _apply_cooked_recipe_with_grad(stage_entry->recipe, stage_entry->cooked, input, stage.reduction);
+		}
+		return input;
+	}
+
+	std::string to_string() const
+	{
+		std::vector<std::string> descriptions;
+		for (auto&& stage : _stages)
+			descriptions.push_back(stage.description);
+		return format("FusedRecipe({})", join(descriptions, " + "));
+	}
+
+private:
+	struct Entry
+	{
+		Shape shape;
+		std::optional<CookedRecipe> cooked;
+	};
+
+	std::vector<FusedStage> _stages;
+	Reduction _reduction;
+	TransformRecipe _recipe; // generic family, the cooked recipe is applied as it is
+	ShapeCache<Entry> _cooked;
+};
+
+TORCH_MODULE(FusedRecipe);
+
+inline auto _fused_stage(std::shared_ptr<torch::nn::Module> const& module) -> std::optional<FusedStage>
+{
+	if (auto layer = std::dynamic_pointer_cast<RearrangeImpl>(module))
+		return FusedStage{ [layer](Shape const& shape) { return layer->cooked_entry(shape); }, "rearrange", layer->to_string() };
+
+	if (auto layer = std::dynamic_pointer_cast<ReduceImpl>(module))
+		return FusedStage{ [layer](Shape const& shape) { return layer->cooked_entry(shape); }, layer->reduction(), layer->to_string() };
+
+	return std::nullopt;
+}
+
+/// @brief Replaces runs of adjacent Rearrange and Reduce layers of a sequential model, nested
+///		sequential models included, by FusedRecipe layers: one reshape, permutation and reduction
+///		per run instead of one per layer. Layers with different reductions (or repeat) are not fused.
+/// @param sequential model, replaced by the fused one, other layers are shared with it
+/// @return one line per fused run, the names of its layers and what they were
+inline auto fuse_einops_layers(torch::nn::Sequential& sequential) -> std::vector<std::string>
+{
+	std::vector<std::string> report;
+	torch::nn::Sequential fused;
+
+	std::vector<FusedStage> stages;
+	std::vector<std::string> names;
+	std::vector<torch::nn::AnyModule> modules;
+
+	auto flush = [&]()
+	{
+		if (stages.size() == 1)
+			fused->push_back(names.front(), modules.front());
+
+		if (stages.size() > 1)
+		{
+			auto layer = FusedRecipe(stages);
+			report.push_back(format("{}: {}", join(names, ", "), layer->to_string()));
+			fused->push_back(names.front(), layer);
+		}
+
+		stages.clear();
+		names.clear();
+		modules.clear();
+	};
+
+	auto children = sequential->named_children();
+	auto module = sequential->begin();
+	for (size_t i = 0; i < children.size(); ++i, ++module)
+	{
+		auto&& name = children[i].key();
+
+		if (auto stage = _fused_stage(module->ptr()))
+		{
+			stages.push_back(stage.value());
+			if (!_reduction_of_fused_stages(stages).has_value())
+			{
+				stages.pop_back();
+				flush();
+				stages.push_back(stage.value());
+			}
+			names.push_back(name);
+			modules.push_back(*module);
+			continue;
+		}
+
+		flush();
+
+		if (auto nested = std::dynamic_pointer_cast<torch::nn::SequentialImpl>(module->ptr()))
+		{
+			auto inner = torch::nn::Sequential(nested);
+			for (auto&& line : fuse_einops_layers(inner))
+				report.push_back(format("{}.{}", name, line));
+			fused->push_back(name, inner);
+			continue;
+		}
+
+		fused->push_back(name, *module);
+	}
+	flush();
+
+	sequential = fused;
+	return report;
+}
+
 #endif // EINOPS_TENSORFLOW_BACKEND
\ No newline at end of file
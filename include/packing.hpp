@@ -1,6 +1,10 @@
 #pragma once
 
+#include <array>
+#include <string_view>
+
 #include <einops.hpp>
+#include <extension/thread_pool.hpp>
 
 namespace einops {
 namespace implementation {
@@ -13,24 +17,602 @@ inline auto analyze_pattern(std::string const& pattern, std::string const& opnam
 		throw Exception(::format("Duplicates in axes names in {}(..., \"{}\")", opname, pattern));
 	if (axes_set.count(_asterisk) == 0)
 		throw Exception(::format("No *-axis in {}(..., \"{}\")", opname, pattern));
+	std::vector<std::string> warnings;
 	for (auto&& axis : axes)
 	{
 		if (axis != _asterisk)
 		{
-			auto&& [is_valid, reason] = ParsedExpression::check_axis_name_return_reason(axis);
+			auto&& [is_valid, reason] = ParsedExpression::check_axis_name_return_reason(axis, false, &warnings);
 			if (!is_valid)
 				throw Exception(format("Invalid axis name {} in {}(..., \"{}\")", axis, opname, pattern));
 		}
 	}
+	ParsedExpression::report_warnings(warnings);
 	auto n_axes_before = index(axes, _asterisk);
 	auto n_axes_after = axes.size() - n_axes_before - 1;
 	auto min_axes = n_axes_before + n_axes_after;
 	return { n_axes_before, n_axes_after, min_axes };
 }
 
+static LRUCache<Hash, std::tuple<int, int, int>> _packPatternCache (256);
+
+inline auto _prepare_pack_pattern(std::string const& pattern, std::string const& opname) -> std::tuple<int, int, int>
+{
+	auto hash = HashBuilder()(pattern, opname);
+	if (auto cached = _packPatternCache.find(hash))
+		return *cached;
+
+	auto analyzed = analyze_pattern(pattern, opname);
+
+	_packPatternCache.put(hash, analyzed);
+
+	return analyzed;
+}
+
+struct PackOptions
+{
+	bool parallel{ false };					// copies of pack_into, pack and unpack_contiguous run on the thread pool
+	int64_t min_chunk_elements{ 1 << 15 };	// larger copies are split in chunks of about this size
+};
+
+inline auto _pack_options() -> PackOptions&
+{
+	static PackOptions options;
+	return options;
+}
+
+// outputs allocated for copies take the type and device of the first tensor, where a
+// concatenation would promote the others, so copying needs all of them to agree
+template <typename Tensor, typename Backend>
+inline bool _same_types(Backend& backend, std::vector<Tensor> const& tensors)
+{
+	return std::all_of(tensors.begin(), tensors.end(), [&](Tensor const& tensor)
+	{
+		return backend.type_name(tensor) == backend.type_name(tensors.front()) &&
+			   backend.device_name(tensor) == backend.device_name(tensors.front());
+	});
+}
+
+// copies every source into its destination of the same shape, in parallel when enabled:
+// small tensors are whole tasks, large ones are chunked along their largest axis. Copies
+// recorded by autograd all rebase the history of the same output, they stay sequential
+template <typename Tensor, typename Backend>
+inline void _copy_all(Backend& backend, std::vector<std::tuple<Tensor, Tensor>> const& copies)
+{
+	auto&& options = _pack_options();
+	auto recorded = std::any_of(copies.begin(), copies.end(), [&](auto&& copy) { return backend.records_gradient(std::get<1>(copy)); });
+	if (!options.parallel || copies.empty() || recorded)
+	{
+		for (auto&& [destination, source] : copies)
+			backend.copy_into(destination, source);
+		return;
+	}
+
+	std::vector<std::tuple<Tensor, Tensor>> tasks;
+	for (auto&& [destination, source] : copies)
+	{
+		auto shape = backend.shape(destination);
+		auto n_elements = prod(shape);
+		if (shape.empty() || n_elements <= options.min_chunk_elements)
+		{
+			tasks.push_back({ destination, source });
+			continue;
+		}
+
+		auto axis = std::max_element(shape.begin(), shape.end()) - shape.begin();
+		auto n_chunks = std::min(shape[axis], (n_elements + options.min_chunk_elements - 1) / options.min_chunk_elements);
+		auto step = (shape[axis] + n_chunks - 1) / n_chunks;
+		for (int64_t start = 0; start < shape[axis]; start += step)
+		{
+			auto length = std::min(step, shape[axis] - start);
+			tasks.push_back({ backend.narrow(destination, axis, start, length), backend.narrow(source, axis, start, length) });
+		}
+	}
+
+	auto state = backend.thread_state();
+	ThreadPool::global().parallel_for(tasks.size(), [&](size_t i)
+	{
+		typename Backend::ThreadStateGuard guard (state);
+		backend.copy_into(std::get<0>(tasks[i]), std::get<1>(tasks[i]));
+	});
+}
+
+// shapes that take place of '*' in every tensor
+template <typename Tensor>
+inline auto _packed_shapes(std::vector<Tensor> const& tensors, std::string const& pattern) -> std::vector<std::vector<int64_t>>
+{
+	auto&& [n_axes_before, n_axes_after, min_axes] = _prepare_pack_pattern(pattern, "pack");
+
+	if (tensors.empty())
+		throw Exception(format("pack(..., \"{}\") received no tensor", pattern));
+
+	auto backend = backends::implementation::get_packing_backend(tensors.front());
+
+	std::vector<std::vector<int64_t>> packed_shapes;
+	for (auto&& [i, tensor] : iters::enumerate(tensors))
+	{
+		auto shape = backend.shape(tensor);
+		if (shape.size() < min_axes)
+			throw Exception(format("packed tensor #{} (enumeration starts with 0) has shape {}, " \
+								   "while pattern {} assumes at least {} axes", print(i), print(shape), pattern, print(min_axes)));
+
+		packed_shapes.push_back(std::vector<int64_t>(shape.begin() + n_axes_before, shape.end() - n_axes_after));
+	}
+	return packed_shapes;
+}
+
+// rearrange(tensor, pattern) as a view of permuted elementary axes: reshaping any tensor of the
+// rearranged shape to the permuted shape only splits axes, so it can be copied into or from that view
+template <typename Tensor>
+struct RearrangedView
+{
+	Tensor permuted;
+	Shape final_shape;
+};
+
+template <typename Tensor, typename Backend>
+inline auto _prepare_rearranged_view(Backend& backend, Tensor const& tensor, std::string const& pattern, AxesLengths const& axes_lengths) -> RearrangedView<Tensor>
+{
+	auto shape = backend.shape(tensor);
+	auto recipe = _prepare_transformation_recipe(pattern, "rearrange", axes_lengths, shape.size());
+	auto cooked = _reconstruct_from_shape(*recipe, shape, axes_lengths);
+	auto&& [init_shapes, axes_reordering, reduced_axes, added_axes, final_shapes, n_axes_w_added] = *cooked;
+
+	auto permuted = init_shapes.has_value() ? backend.reshape(tensor, init_shapes.value()) : tensor;
+	if (axes_reordering.has_value())
+		permuted = backend.transpose(permuted, axes_reordering.value());
+
+	return { permuted, final_shapes.value_or(backend.shape(permuted)) };
+}
+
+// compile-time counterpart of analyze_pattern, for patterns given as template arguments:
+// axis names are identifiers that don't start or end with an underscore
+
+struct PackPatternInfo
+{
+	bool is_valid;
+	int n_axes_before;
+	int n_axes_after;
+};
+
+constexpr auto _is_pack_axis_name(std::string_view axis) -> bool
+{
+	auto is_alpha = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); };
+	auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+
+	if (axis.empty() || !is_alpha(axis.front()) || axis.back() == '_')
+		return false;
+	for (auto c : axis)
+		if (!is_alpha(c) && !is_digit(c) && c != '_')
+			return false;
+	return true;
+}
+
+constexpr auto _analyze_pack_pattern(std::string_view pattern) -> PackPatternInfo
+{
+	PackPatternInfo info{ false, 0, 0 };
+	int n_axes = 0;
+	int n_asterisks = 0;
+
+	for (size_t start = 0; start <= pattern.size();)
+	{
+		auto stop = std::min(pattern.find(' ', start), pattern.size());
+		auto axis = pattern.substr(start, stop - start);
+		if (axis == "*")
+		{
+			n_asterisks++;
+			info.n_axes_before = n_axes;
+		}
+		else
+		if (!_is_pack_axis_name(axis))
+			return info;
+
+		for (auto next = stop + 1; next <= pattern.size();)
+		{
+			auto next_stop = std::min(pattern.find(' ', next), pattern.size());
+			if (pattern.substr(next, next_stop - next) == axis)
+				return info;
+			next = next_stop + 1;
+		}
+
+		n_axes++;
+		start = stop + 1;
+	}
+
+	info.is_valid = n_asterisks == 1;
+	info.n_axes_after = n_axes - info.n_axes_before - 1;
+	return info;
+}
+
+/// @brief Shape that takes place of '*' in a tensor, held inline instead of in a vector.
+class InlineShape
+{
+public:
+	static constexpr size_t capacity = 8;
+
+	InlineShape() = default;
+
+	template <typename Iterator>
+	InlineShape(Iterator first, Iterator last)
+	{
+		auto size = std::distance(first, last);
+		if (size < 0 || size_t(size) > capacity)
+			throw Exception(format("Inline packed shapes have at most {} axes, received {}", print(capacity), print(size)));
+
+		std::copy(first, last, _dims.begin());
+		_size = size;
+	}
+
+	InlineShape(std::initializer_list<int64_t> dims)
+		: InlineShape(dims.begin(), dims.end())
+	{}
+
+	auto size() const -> size_t { return _size; }
+	auto begin() const { return _dims.begin(); }
+	auto end() const { return _dims.begin() + _size; }
+	auto operator[](size_t i) const -> int64_t { return _dims[i]; }
+
+	auto vec() const -> std::vector<int64_t>
+	{
+		return { begin(), end() };
+	}
+
+	auto operator==(InlineShape const& other) const -> bool
+	{
+		return std::equal(begin(), end(), other.begin(), other.end());
+	}
+
+private:
+	std::array<int64_t, capacity> _dims{};
+	size_t _size{ 0 };
+};
+
+// pack of a fixed number of tensors, a single vector is used for the concatenation
+template <typename Tensor, size_t N>
+inline auto _pack_fixed(std::array<Tensor, N> const& tensors, std::string const& pattern, int n_axes_before, int n_axes_after)
+	-> std::tuple<Tensor, std::array<InlineShape, N>>
+{
+	auto backend = backends::implementation::get_packing_backend(tensors.front());
+
+	std::array<InlineShape, N> packed_shapes;
+	std::vector<Tensor> reshaped_tensors;
+	reshaped_tensors.reserve(N);
+	for (auto i : iters::range(N))
+	{
+		auto shape = backend.shape(tensors[i]);
+		if (int64_t(shape.size()) < n_axes_before + n_axes_after)
+			throw Exception(format("packed tensor #{} (enumeration starts with 0) has shape {}, " \
+								   "while pattern {} assumes at least {} axes", print(i), print(shape), pattern, print(n_axes_before + n_axes_after)));
+
+		packed_shapes[i] = InlineShape(shape.begin() + n_axes_before, shape.end() - n_axes_after);
+		shape.erase(shape.begin() + n_axes_before, shape.end() - n_axes_after);
+		shape.insert(shape.begin() + n_axes_before, -1);
+		reshaped_tensors.push_back(backend.reshape(tensors[i], shape));
+	}
+
+	return { backend.concat(reshaped_tensors, n_axes_before), packed_shapes };
+}
+
+template <typename Tensor, size_t N>
+inline auto _unpack_fixed(Tensor const& tensor, std::array<InlineShape, N> const& packed_shapes, std::string const& pattern, int n_axes_before, int n_axes_after)
+	-> std::array<Tensor, N>
+{
+	auto backend = backends::implementation::get_packing_backend(tensor);
+	auto input_shape = backend.shape(tensor);
+	if (int64_t(input_shape.size()) != n_axes_before + 1 + n_axes_after)
+		throw Exception(format("unpack(..., {}) received input of wrong dim with shape {}", pattern, print(input_shape)));
+
+	std::vector<int64_t> lengths;
+	lengths.reserve(N);
+	for (auto&& packed_shape : packed_shapes)
+	{
+		if (std::find(packed_shape.begin(), packed_shape.end(), -1) != packed_shape.end())
+			throw Exception(format("unpack(..., {}) infers -1 dimensions from packed shapes of a vector only", pattern));
+		lengths.push_back(prod(packed_shape.vec()));
+	}
+
+	try
+	{
+		auto slots = backend.split(tensor, lengths, n_axes_before);
+
+		std::array<Tensor, N> output;
+		for (auto i : iters::range(N))
+		{
+			auto shape = input_shape;
+			shape.erase(shape.begin() + n_axes_before);
+			shape.insert(shape.begin() + n_axes_before, packed_shapes[i].begin(), packed_shapes[i].end());
+			output[i] = backend.reshape(slots[i], shape);
+		}
+		return output;
+	}
+	catch (...)
+	{
+		throw Exception(format("Error during unpack(..., \"{}\"): could not split axis of size {}" \
+							   " into requested {}", pattern, print(input_shape[n_axes_before]), print(lengths)));
+	}
+}
+
+#if __cplusplus >= 202002L
+
+// string literal usable as a template argument, e.g. pack<"b * d">(x, y)
+template <size_t N>
+struct PackPattern
+{
+	char value[N]{};
+
+	constexpr PackPattern(char const (&pattern)[N])
+	{
+		std::copy_n(pattern, N, value);
+	}
+
+	constexpr auto view() const -> std::string_view
+	{
+		return { value, N - 1 };
+	}
+};
+
+#endif
+
 } // namespace implementation
 
 using namespace backends::implementation;
+using implementation::InlineShape;
+
+/// @brief Reusable layout of pack and unpack: the parsed pattern, the packed shapes
+///		and where each of them lives along the packed axis. Building the plan once
+///		avoids any parsing or offsets computation in the following calls.
+class PackPlan
+{
+public:
+	/// @param pattern pattern that is shared for all inputs and output, e.g. "i j * k" or "batch seq *"
+	/// @param packed_shapes shapes that take place of '*', at most one of them may contain -1
+	/// @param alignment every slot starts at a multiple of alignment along the packed axis,
+	///		the packed axis is padded to a multiple of it as well
+	PackPlan(std::string const& pattern, std::vector<std::vector<int64_t>> const& packed_shapes, int64_t alignment = 1)
+		: _pattern(pattern)
+		, _packed_shapes(packed_shapes)
+		, _alignment(alignment)
+	{
+		std::tie(_n_axes_before, _n_axes_after, std::ignore) = implementation::_prepare_pack_pattern(pattern, "unpack");
+
+		if (alignment < 1)
+			throw Exception(format("Pack alignment must be positive, received {}", implementation::print(alignment)));
+
+		for (auto&& [i, packed_shape] : iters::enumerate(packed_shapes))
+		{
+			auto is_unknown = contains<int64_t>(packed_shape, -1);
+			if (is_unknown && _unknown.has_value())
+				throw Exception(format("unpack(..., {}) received more than one -1 in {} and can't infer dimensions", pattern, implementation::print(packed_shapes)));
+			if (is_unknown)
+				_unknown = i;
+
+			_lengths.push_back(is_unknown ? -1 : prod(packed_shape));
+			if (!is_unknown)
+				_known_length += _lengths.back();
+		}
+
+		if (_unknown.has_value() && alignment > 1)
+			throw Exception(format("Padded pack layouts can't infer dimensions, received {}", implementation::print(packed_shapes)));
+
+		if (!_unknown.has_value())
+		{
+			int64_t offset = 0;
+			for (auto length : _lengths)
+			{
+				_offsets.push_back(offset);
+				offset = align(offset + length);
+			}
+			_packed_length = offset;
+		}
+	}
+
+	auto pattern() const -> std::string const& { return _pattern; }
+	auto packed_shapes() const -> std::vector<std::vector<int64_t>> const& { return _packed_shapes; }
+
+	/// @brief lengths of the slots along the packed axis, -1 for the inferred one
+	auto lengths() const -> std::vector<int64_t> const& { return _lengths; }
+
+	/// @brief starts of the slots along the packed axis, empty when a length is inferred
+	auto offsets() const -> std::vector<int64_t> const& { return _offsets; }
+
+	/// @brief length of the packed axis, padding included, -1 when a length is inferred
+	auto packed_length() const -> int64_t { return _packed_length; }
+
+	auto alignment() const -> int64_t { return _alignment; }
+
+	/// @brief position of the packed axis
+	auto axis() const -> int64_t { return _n_axes_before; }
+
+	// concatenation, or copies into a preallocated output when parallel packing is enabled
+	// and all tensors have the same type and device
+	template <typename Tensor>
+	auto pack(std::vector<Tensor> const& tensors) const -> Tensor
+	{
+		if (_alignment > 1)
+			throw Exception(format("pack(..., \"{}\") can't pad slots, use pack_into with a preallocated output", _pattern));
+		if (tensors.empty())
+			throw Exception(format("pack(..., \"{}\") received no tensor", _pattern));
+		check_count(tensors.size());
+
+		auto backend = get_packing_backend(tensors.front());
+
+		if (implementation::_pack_options().parallel && _packed_length >= 0 && implementation::_same_types(backend, tensors))
+		{
+			auto shape = slot_shape(backend.shape(tensors.front()));
+			shape[_n_axes_before] = _packed_length;
+
+			auto packed = backend.empty(tensors.front(), shape);
+			pack_into(packed, tensors);
+			return packed;
+		}
+
+		std::vector<Tensor> reshaped_tensors;
+		for (auto&& [i, tensor] : iters::enumerate(tensors))
+			reshaped_tensors.push_back(backend.reshape(tensor, checked_slot_shape(backend.shape(tensor), i)));
+		return backend.concat(reshaped_tensors, _n_axes_before);
+	}
+
+	// every input is copied straight into its slot of the output, padding is left untouched,
+	// the copies run on the thread pool when parallel packing is enabled
+	template <typename Tensor>
+	void pack_into(Tensor const& out, std::vector<Tensor> const& tensors) const
+	{
+		check_count(tensors.size());
+
+		auto backend = get_packing_backend(out);
+		auto out_shape = backend.shape(out);
+		if (int64_t(out_shape.size()) != _n_axes_before + 1 + _n_axes_after || out_shape[_n_axes_before] != _packed_length)
+			throw Exception(format("pack_into(..., \"{}\") received output of shape {}, packed axis of length {} expected", 
+								   _pattern, implementation::print(out_shape), implementation::print(_packed_length)));
+
+		std::vector<std::tuple<Tensor, Tensor>> copies;
+		for (auto&& [i, tensor] : iters::enumerate(tensors))
+		{
+			auto shape = checked_slot_shape(backend.shape(tensor), i);
+			auto offset = _offsets[i];
+			auto length = _lengths[i];
+			auto same_axes = std::equal(shape.begin(), shape.begin() + _n_axes_before, out_shape.begin()) &&
+							 std::equal(shape.begin() + _n_axes_before + 1, shape.end(), out_shape.begin() + _n_axes_before + 1);
+			if (!same_axes)
+				throw Exception(format("pack_into(..., \"{}\") can't copy a tensor of shape {} into output of shape {}",
+									   _pattern, implementation::print(backend.shape(tensor)), implementation::print(out_shape)));
+
+			copies.push_back({ backend.narrow(out, _n_axes_before, offset, length), backend.reshape(tensor, shape) });
+		}
+
+		implementation::_copy_all(backend, copies);
+	}
+
+	// unpack into new contiguous tensors instead of views of the input
+	template <typename Tensor>
+	auto unpack_contiguous(Tensor const& tensor) const -> std::vector<Tensor>
+	{
+		auto backend = get_packing_backend(tensor);
+
+		std::vector<Tensor> output;
+		std::vector<std::tuple<Tensor, Tensor>> copies;
+		for (auto&& view : unpack(tensor))
+		{
+			output.push_back(backend.empty(view, backend.shape(view)));
+			copies.push_back({ output.back(), view });
+		}
+
+		implementation::_copy_all(backend, copies);
+		return output;
+	}
+
+	// a single split along the packed axis, every output is a view of its slot
+	template <typename Tensor>
+	auto unpack(Tensor const& tensor) const -> std::vector<Tensor>
+	{
+		auto backend = get_packing_backend(tensor);
+		auto input_shape = backend.shape(tensor);
+		if (int64_t(input_shape.size()) != _n_axes_before + 1 + _n_axes_after)
+			throw Exception(format("unpack(..., {}) received input of wrong dim with shape {}", _pattern, implementation::print(input_shape)));
+
+		auto total_length = input_shape[_n_axes_before];
+		auto lengths = _lengths;
+		if (_unknown.has_value())
+			lengths[_unknown.value()] = total_length - _known_length;
+
+		try
+		{
+			std::vector<Tensor> slots;
+			if (_alignment == 1)
+				slots = backend.split(tensor, lengths, _n_axes_before);
+			else
+			{
+				if (total_length != _packed_length)
+					throw Exception("Padded packed axis of unexpected length.");
+				for (auto&& [offset, length] : iters::zip(_offsets, lengths))
+					slots.push_back(backend.narrow(tensor, _n_axes_before, offset, length));
+			}
+
+			std::vector<Tensor> output;
+			for (auto&& [slot, packed_shape, length] : iters::zip(slots, _packed_shapes, lengths))
+			{
+				auto shape = input_shape;
+				auto element_shape = resolve(packed_shape, length);
+				shape.erase(shape.begin() + _n_axes_before);
+				shape.insert(shape.begin() + _n_axes_before, element_shape.begin(), element_shape.end());
+				output.push_back(backend.reshape(slot, shape));
+			}
+			return output;
+		}
+		catch (...)
+		{
+			throw Exception(format("Error during unpack(..., \"{}\"): could not split axis of size {}" \
+								   " into requested {}", _pattern, implementation::print(total_length), implementation::print(_packed_shapes)));
+		}
+	}
+
+private:
+	std::string _pattern;
+	std::vector<std::vector<int64_t>> _packed_shapes;
+	int _n_axes_before{ 0 };
+	int _n_axes_after{ 0 };
+	std::vector<int64_t> _lengths;
+	std::vector<int64_t> _offsets;
+	std::optional<size_t> _unknown;
+	int64_t _known_length{ 0 };
+	int64_t _alignment{ 1 };
+	int64_t _packed_length{ -1 };
+
+	auto align(int64_t offset) const -> int64_t
+	{
+		return (offset + _alignment - 1) / _alignment * _alignment;
+	}
+
+	void check_count(size_t n_tensors) const
+	{
+		if (n_tensors != _packed_shapes.size())
+			throw Exception(format("pack(..., \"{}\") expects {} tensors, received {}", _pattern, implementation::print(_packed_shapes.size()), implementation::print(n_tensors)));
+	}
+
+	// shape of a packed tensor with its packed axes merged into one
+	auto slot_shape(std::vector<int64_t> shape) const -> std::vector<int64_t>
+	{
+		auto n_packed_axes = int64_t(shape.size()) - _n_axes_before - _n_axes_after;
+		if (n_packed_axes < 0)
+			throw Exception(format("packed tensor has shape {}, while pattern {} assumes at least {} axes", implementation::print(shape), _pattern, implementation::print(_n_axes_before + _n_axes_after)));
+
+		shape.erase(shape.begin() + _n_axes_before, shape.begin() + _n_axes_before + n_packed_axes);
+		shape.insert(shape.begin() + _n_axes_before, -1);
+		return shape;
+	}
+
+	// slot shape of the i-th input, the length of its packed axes checked against the plan
+	auto checked_slot_shape(std::vector<int64_t> const& shape, size_t i) const -> std::vector<int64_t>
+	{
+		auto slot = slot_shape(shape);
+		auto length = prod(std::vector<int64_t>(shape.begin() + _n_axes_before, shape.end() - _n_axes_after));
+		if (_lengths[i] >= 0 && length != _lengths[i])
+			throw Exception(format("pack(..., \"{}\") received tensor #{} (enumeration starts with 0) of shape {}, while its packed shape is {}",
+								   _pattern, implementation::print(i), implementation::print(shape), implementation::print(_packed_shapes[i])));
+
+		slot[_n_axes_before] = length;
+		return slot;
+	}
+
+	// replaces -1 in a packed shape by what is left of the slot length
+	static auto resolve(std::vector<int64_t> const& packed_shape, int64_t length) -> std::vector<int64_t>
+	{
+		if (!contains<int64_t>(packed_shape, -1))
+			return packed_shape;
+
+		int64_t known = 1;
+		for (auto dim : packed_shape)
+			if (dim != -1)
+				known *= dim;
+
+		if (length < 0 || known == 0 || length % known != 0)
+			throw Exception("Can't infer the -1 dimension of a packed shape.");
+
+		auto resolved = packed_shape;
+		std::replace(resolved.begin(), resolved.end(), int64_t(-1), length / known);
+		return resolved;
+	}
+};
 
 /// @brief Packs several tensors into one.
 ///		See einops tutorial for introduction into packing (and how it replaces stack and concatenation).
@@ -41,34 +623,222 @@ using namespace backends::implementation;
 template <typename Tensor>
 auto pack(std::vector<Tensor> const& tensors, std::string const& pattern) -> std::tuple<Tensor, std::vector<std::vector<int64_t>>>
 {
-	auto&& [n_axes_before, n_axes_after, min_axes] = implementation::analyze_pattern(pattern, "pack");
+	auto packed_shapes = implementation::_packed_shapes(tensors, pattern);
+	return std::make_tuple(PackPlan(pattern, packed_shapes).pack(tensors), packed_shapes);
+}
+
+/// @brief Packs several tensors into one, following a plan made for their shapes.
+/// @param tensors tensors to be packed, their packed axes match the shapes of the plan
+/// @param plan pack plan, e.g. built from the packed shapes returned by a previous pack
+/// @return packed tensor.
+template <typename Tensor>
+auto pack(std::vector<Tensor> const& tensors, PackPlan const& plan) -> Tensor
+{
+	return plan.pack(tensors);
+}
+
+/// @brief Packs several tensors straight into a preallocated output, e.g. a bucket of a buffer pool,
+///		every input is copied into its slot and no packed tensor is allocated.
+/// @param out output of the packed shape, its packed axis has the length of plan.packed_length()
+///		for the plan of these tensors, pattern and alignment
+/// @param tensors tensors to be packed, can be of different dimensionality
+/// @param pattern pattern that is shared for all inputs and output, e.g. "i j * k" or "batch seq *"
+/// @param alignment every slot starts at a multiple of alignment along the packed axis
+/// @return plan of the layout, to unpack the output or to pack into it again.
+template <typename Tensor>
+auto pack_into(Tensor const& out, std::vector<Tensor> const& tensors, std::string const& pattern, int64_t alignment = 1) -> PackPlan
+{
+	auto packed_shapes = implementation::_packed_shapes(tensors, pattern);
+
+	auto plan = PackPlan(pattern, packed_shapes, alignment);
+	plan.pack_into(out, tensors);
+	return plan;
+}
+
+/// @brief Packs several tensors straight into a preallocated output, following a plan.
+/// @param out output of the packed shape, its packed axis has the length of plan.packed_length()
+/// @param tensors tensors to be packed, their packed axes match the shapes of the plan
+/// @param plan pack plan, possibly with padded slots
+template <typename Tensor>
+void pack_into(Tensor const& out, std::vector<Tensor> const& tensors, PackPlan const& plan)
+{
+	plan.pack_into(out, tensors);
+}
+
+/// @brief Packs several tensors into one, each of them rearranged while it is copied into the
+///		packed output, e.g. "b c h w -> b (h w) c" with pattern "b * c". Every element is moved once,
+///		no rearranged intermediate is created.
+/// @param tensors tensors to be packed
+/// @param pattern pattern that is shared for all rearranged inputs and output, e.g. "b * c"
+/// @param rearrange_patterns one rearrangement pattern for every input, or a single one for all of them
+/// @param axes_lengths any additional specifications for dimensions, shared by the patterns
+/// @return tuple with { packed_tensor, packed_shapes }, packed shapes of the rearranged inputs.
+template <typename Tensor, typename... Args>
+auto pack(std::vector<Tensor> const& tensors, std::string const& pattern, std::vector<std::string> const& rearrange_patterns, Args... axes_lengths) 
+	-> std::tuple<Tensor, std::vector<std::vector<int64_t>>>
+{
+	using implementation::print;
+
+	if (tensors.empty())
+		throw Exception(format("pack(..., \"{}\") received no tensor", pattern));
+
+	if (rearrange_patterns.size() != tensors.size() && rearrange_patterns.size() != 1)
+		throw Exception(format("pack(..., \"{}\") received {} rearrange patterns for {} tensors", pattern, print(rearrange_patterns.size()), print(tensors.size())));
+
+	auto&& [n_axes_before, n_axes_after, min_axes] = implementation::_prepare_pack_pattern(pattern, "pack");
+	auto hashable_axes_lengths = implementation::_hashable_axes_lengths(axes_lengths...);
 
 	auto backend = get_packing_backend(tensors.front());
+	if (!implementation::_same_types(backend, tensors))
+		throw Exception(format("pack(..., \"{}\") copies rearranged tensors into one output, they need the same type and device", pattern));
 
-	std::vector<Tensor> reshaped_tensors;
+	std::vector<implementation::RearrangedView<Tensor>> views;
 	std::vector<std::vector<int64_t>> packed_shapes;
-
 	for (auto&& [i, tensor] : iters::enumerate(tensors))
 	{
-		auto shape = backend.shape(tensor);
+		auto&& rearrange_pattern = rearrange_patterns[rearrange_patterns.size() == 1 ? 0 : i];
+		views.push_back(implementation::_prepare_rearranged_view(backend, tensor, rearrange_pattern, hashable_axes_lengths));
+		auto&& shape = views.back().final_shape;
 		if (shape.size() < min_axes)
-			throw Exception(format("packed tensor #{} (enumeration starts with 0) has shape {}, " \
-								   "while pattern {} assumes at least {} axes", i, implementation::print(shape), pattern, implementation::print(min_axes)));
+			throw Exception(format("rearranged tensor has shape {}, while pattern {} assumes at least {} axes", print(shape), pattern, print(min_axes)));
+		packed_shapes.push_back(subvec(shape, n_axes_before, shape.size() - n_axes_after));
+	}
 
-		auto axis_after_packed_axes = shape.size() - n_axes_after;
-		auto packed_shape = subvec(shape, n_axes_before, axis_after_packed_axes);
-		packed_shapes.push_back(packed_shape);
-		std::vector<int64_t> reshape_axes;
-		{
-			for (auto&& axis : iters::range(n_axes_before))
-				reshape_axes.push_back(shape[axis]);
-			reshape_axes.push_back(-1);
-			for (auto&& axis : iters::range(axis_after_packed_axes, shape.size()))
-				reshape_axes.push_back(shape[axis]);
-		}
-		reshaped_tensors.push_back(backend.reshape(tensor, reshape_axes));
+	auto plan = PackPlan(pattern, packed_shapes);
+
+	auto shape = views.front().final_shape;
+	shape.erase(shape.begin() + n_axes_before, shape.end() - n_axes_after);
+	shape.insert(shape.begin() + n_axes_before, plan.packed_length());
+	auto packed = backend.empty(tensors.front(), shape);
+
+	std::vector<std::tuple<Tensor, Tensor>> copies;
+	for (auto&& [view, offset, length] : iters::zip(views, plan.offsets(), plan.lengths()))
+	{
+		auto&& final_shape = view.final_shape;
+		auto same_axes = std::equal(shape.begin(), shape.begin() + n_axes_before, final_shape.begin()) &&
+						 std::equal(shape.end() - n_axes_after, shape.end(), final_shape.end() - n_axes_after);
+		if (!same_axes)
+			throw Exception(format("pack(..., \"{}\") can't pack rearranged shapes {} and {}", pattern, print(final_shape), print(views.front().final_shape)));
+
+		auto slot = backend.narrow(packed, n_axes_before, offset, length);
+		copies.push_back({ backend.reshape(slot, backend.shape(view.permuted)), view.permuted });
 	}
-	return std::make_tuple(backend.concat(reshaped_tensors, n_axes_before), packed_shapes);
+
+	implementation::_copy_all(backend, copies);
+	return std::make_tuple(packed, packed_shapes);
+}
+
+/// @brief Unpacks a single tensor into several, each of them rearranged while it is copied out of
+///		the packed tensor, e.g. "b (h w) c -> b c h w". Every output is a new contiguous tensor.
+/// @param tensor tensor to be unpacked.
+/// @param packed_shapes packed_shapes (aka PS) is a list of shapes that take place of '*' in each output,
+///		before the rearrangement
+/// @param pattern pattern that is shared for input and all outputs, e.g. "b * c"
+/// @param rearrange_patterns one rearrangement pattern for every output, or a single one for all of them
+/// @param axes_lengths any additional specifications for dimensions, shared by the patterns
+/// @return list of tensors.
+template <typename Tensor, typename... Args>
+auto unpack(Tensor const& tensor, std::vector<std::vector<int64_t>> const& packed_shapes, std::string const& pattern, 
+			std::vector<std::string> const& rearrange_patterns, Args... axes_lengths) -> std::vector<Tensor>
+{
+	using implementation::print;
+
+	if (rearrange_patterns.size() != packed_shapes.size() && rearrange_patterns.size() != 1)
+		throw Exception(format("unpack(..., \"{}\") received {} rearrange patterns for {} outputs", pattern, print(rearrange_patterns.size()), print(packed_shapes.size())));
+
+	auto hashable_axes_lengths = implementation::_hashable_axes_lengths(axes_lengths...);
+
+	auto backend = get_packing_backend(tensor);
+
+	std::vector<Tensor> output;
+	std::vector<std::tuple<Tensor, Tensor>> copies;
+	auto slots = PackPlan(pattern, packed_shapes).unpack(tensor);
+	for (auto&& [i, slot] : iters::enumerate(slots))
+	{
+		auto&& rearrange_pattern = rearrange_patterns[rearrange_patterns.size() == 1 ? 0 : i];
+		auto view = implementation::_prepare_rearranged_view(backend, slot, rearrange_pattern, hashable_axes_lengths);
+		output.push_back(backend.empty(slot, view.final_shape));
+		copies.push_back({ backend.reshape(output.back(), backend.shape(view.permuted)), view.permuted });
+	}
+
+	implementation::_copy_all(backend, copies);
+	return output;
+}
+
+/// @brief Result of a ragged pack, e.g. variable length sequences for padding-free attention.
+template <typename Tensor>
+struct RaggedPack
+{
+	Tensor packed;
+	Tensor cu_seqlens;					// int32 starts of the tensors along the packed axis, followed by its length
+	std::optional<Tensor> segment_ids;	// int32 index of the tensor every position of the packed axis comes from
+	int64_t max_length;					// longest tensor along the packed axis
+	PackPlan plan;
+};
+
+/// @brief Packs tensors of different lengths along the packed axis, and returns their offsets along it.
+///		Offsets come from the layout computed for the copy, no prefix sum runs on the packed tensor.
+/// @param tensors tensors to be packed, e.g. sequences of shape (length, dim) with pattern "* dim"
+/// @param pattern pattern that is shared for all inputs and output, e.g. "* dim" or "batch * dim"
+/// @param with_segment_ids also return the index of the tensor of every packed position
+/// @return packed tensor, cu_seqlens, optional segment ids, max length and plan to unpack.
+template <typename Tensor>
+auto pack_ragged(std::vector<Tensor> const& tensors, std::string const& pattern, bool with_segment_ids = false) -> RaggedPack<Tensor>
+{
+	auto plan = PackPlan(pattern, implementation::_packed_shapes(tensors, pattern));
+	auto packed = plan.pack(tensors);
+
+	auto backend = get_packing_backend(packed);
+
+	auto offsets = plan.offsets();
+	offsets.push_back(plan.packed_length());
+
+	auto&& lengths = plan.lengths();
+	auto max_length = *std::max_element(lengths.begin(), lengths.end());
+
+	std::optional<Tensor> segment_ids;
+	if (with_segment_ids)
+	{
+		auto segments = backend.indices(iters::range<int64_t>(lengths.size()).vec(), packed);
+		segment_ids = backend.repeat_interleave(segments, backend.indices(lengths, packed), plan.packed_length());
+	}
+
+	return { packed, backend.indices(offsets, packed), segment_ids, max_length, plan };
+}
+
+/// @brief Unpacks a ragged tensor following its offsets along the packed axis.
+/// @param tensor tensor to be unpacked.
+/// @param cu_seqlens starts of the tensors along the packed axis, followed by its length
+/// @param pattern pattern that is shared for input and all outputs, e.g. "* dim"
+/// @return list of tensors, views of the input with a single packed axis.
+template <typename Tensor>
+auto unpack_ragged(Tensor const& tensor, std::vector<int64_t> const& cu_seqlens, std::string const& pattern) -> std::vector<Tensor>
+{
+	if (cu_seqlens.empty() || cu_seqlens.front() != 0)
+		throw Exception(format("unpack_ragged(..., \"{}\") expects offsets starting with 0, received {}", pattern, implementation::print(cu_seqlens)));
+
+	std::vector<std::vector<int64_t>> packed_shapes;
+	for (auto i : iters::range(cu_seqlens.size() - 1))
+	{
+		if (cu_seqlens[i + 1] < cu_seqlens[i])
+			throw Exception(format("unpack_ragged(..., \"{}\") expects non-decreasing offsets, received {}", pattern, implementation::print(cu_seqlens)));
+		packed_shapes.push_back({ cu_seqlens[i + 1] - cu_seqlens[i] });
+	}
+
+	return PackPlan(pattern, packed_shapes).unpack(tensor);
+}
+
+/// @brief Unpacks a ragged tensor following its offsets along the packed axis,
+///		the offsets are read once from the (possibly device) tensor.
+/// @param tensor tensor to be unpacked.
+/// @param cu_seqlens integer tensor, starts of the tensors along the packed axis, followed by its length
+/// @param pattern pattern that is shared for input and all outputs, e.g. "* dim"
+/// @return list of tensors, views of the input with a single packed axis.
+template <typename Tensor>
+auto unpack_ragged(Tensor const& tensor, Tensor const& cu_seqlens, std::string const& pattern) -> std::vector<Tensor>
+{
+	auto backend = get_packing_backend(tensor);
+	return unpack_ragged(tensor, backend.values(cu_seqlens), pattern);
 }
 
 /// @brief Unpacks a single tensor into several by splitting over a selected axes.
@@ -82,65 +852,96 @@ auto pack(std::vector<Tensor> const& tensors, std::string const& pattern) -> std
 template <typename Tensor>
 auto unpack(Tensor const& tensor, std::vector<std::vector<int64_t>> const& packed_shapes, std::string const& pattern) -> std::vector<Tensor>
 {
-	auto&& [n_axes_before, n_axes_after, min_axes] = implementation::analyze_pattern(pattern, "unpack");
+	return PackPlan(pattern, packed_shapes).unpack(tensor);
+}
 
-	auto backend = get_packing_backend(tensor);
-	auto input_shape = backend.shape(tensor);
-	if (input_shape.size() != n_axes_before + 1 + n_axes_after)
-		throw Exception(format("unpack(..., {}) received input of wrong dim with shape {}", pattern, implementation::print(input_shape)));
+/// @brief Unpacks a single tensor into several contiguous tensors, copies run in parallel
+///		when parallel packing is enabled.
+/// @param tensor tensor to be unpacked.
+/// @param plan pack plan of the pattern and packed shapes
+/// @return list of new tensors.
+template <typename Tensor>
+auto unpack_contiguous(Tensor const& tensor, PackPlan const& plan) -> std::vector<Tensor>
+{
+	return plan.unpack_contiguous(tensor);
+}
 
-	auto unpacked_axis = n_axes_before;
+/// @brief Enables parallel copies in pack, pack_into and unpack_contiguous (disabled by default).
+///		pack then writes every input into a preallocated output of the type of the first input,
+///		instead of concatenating them, small inputs are copied as whole tasks and large ones in chunks.
+/// @param enabled true to run copies on the library thread pool
+/// @param min_chunk_elements copies larger than this number of elements are split in chunks
+inline void set_pack_parallel(bool enabled, int64_t min_chunk_elements = 1 << 15)
+{
+	implementation::_pack_options() = { enabled, std::max<int64_t>(1, min_chunk_elements) };
+}
 
-	auto lengths_of_composed_axes = processor<int>(packed_shapes, [=](auto&& x) { return contains<int64_t>(x, -1) ? -1 : prod(x); });
+/// @brief Unpacks a single tensor into several, following a plan built once for the layout.
+/// @param tensor tensor to be unpacked.
+/// @param plan pack plan of the pattern and packed shapes
+/// @return list of tensors, views of the input.
+template <typename Tensor>
+auto unpack(Tensor const& tensor, PackPlan const& plan) -> std::vector<Tensor>
+{
+	return plan.unpack(tensor);
+}
 
-	auto n_unknown_composed_axes = sum<int>(processor<bool>(lengths_of_composed_axes, [=](auto&& x) { return bool(x == -1); }));
 
-	if (n_unknown_composed_axes > 1)
-		throw Exception(::format("unpack(..., {}) received more than one -1 in {packed_shapes} and can't infer dimensions", pattern));
+/// @brief Packs a fixed number of tensors into one, e.g. auto [packed, ps] = pack(std::tie(x, y, z), "b * d").
+///		Packed shapes are held inline, one per tensor, instead of in vectors.
+/// @param tensors tuple of the tensors to be packed, e.g. std::tie(x, y, z)
+/// @param pattern pattern that is shared for all inputs and output, e.g. "i j * k" or "batch seq *"
+/// @return tuple with { packed_tensor, packed_shapes }, an array of InlineShape.
+template <typename Tensor, typename... Tensors>
+auto pack(std::tuple<Tensor, Tensors...> const& tensors, std::string const& pattern)
+{
+	using PackedTensor = std::decay_t<Tensor>;
 
-	auto split_positions = std::vector<int64_t>(packed_shapes.size(), 0);
-		 split_positions.push_back(input_shape[unpacked_axis]);
+	auto&& [n_axes_before, n_axes_after, min_axes] = implementation::_prepare_pack_pattern(pattern, "pack");
+	auto array = std::apply([](auto&&... tensor) { return std::array<PackedTensor, 1 + sizeof...(Tensors)>{ tensor... }; }, tensors);
+	return implementation::_pack_fixed(array, pattern, n_axes_before, n_axes_after);
+}
 
-	if (n_unknown_composed_axes == 0)
-	{
-		for (auto&& [i, x] : iters::enumerate(lengths_of_composed_axes))
-			if (i < lengths_of_composed_axes.size()-1)
-				split_positions[i + 1] = split_positions[i] + x;
-	}
-	else
-	{
-		auto unknown_composed_axis = index(lengths_of_composed_axes, -1);
+/// @brief Unpacks a single tensor into a fixed number of tensors, e.g. auto [x, y, z] = unpack(packed, ps, "b * d").
+/// @param tensor tensor to be unpacked.
+/// @param packed_shapes inline packed shapes, as returned by the fixed size pack
+/// @param pattern pattern that is shared for input and all outputs, e.g. "i j * k" or "batch seq *"
+/// @return array of tensors.
+template <typename Tensor, size_t N>
+auto unpack(Tensor const& tensor, std::array<InlineShape, N> const& packed_shapes, std::string const& pattern) -> std::array<Tensor, N>
+{
+	auto&& [n_axes_before, n_axes_after, min_axes] = implementation::_prepare_pack_pattern(pattern, "unpack");
+	return implementation::_unpack_fixed(tensor, packed_shapes, pattern, n_axes_before, n_axes_after);
+}
 
-		for (auto&& i : iters::range<int64_t>(unknown_composed_axis))
-			split_positions[i + 1] = split_positions[i] + lengths_of_composed_axes[i];
+#if __cplusplus >= 202002L
 
-		for (auto&& j : reverse(iters::range<int64_t>(unknown_composed_axis + 1, lengths_of_composed_axes.size()).vec()))
-			split_positions[j] = split_positions[j + 1] - lengths_of_composed_axes[j];
-	}
+/// @brief Packs tensors with a pattern checked at compile time, e.g. auto [packed, ps] = pack<"b * d">(x, y, z).
+/// @param tensors tensors to be packed, can be of different dimensionality
+/// @return tuple with { packed_tensor, packed_shapes }, an array of InlineShape.
+template <implementation::PackPattern pattern, typename Tensor, typename... Tensors>
+auto pack(Tensor const& tensor, Tensors const&... tensors)
+{
+	constexpr auto analyzed = implementation::_analyze_pack_pattern(pattern.view());
+	static_assert(analyzed.is_valid, "pack pattern needs exactly one * and unique axis names");
 
-	auto shape_start = subvec(input_shape, 0, unpacked_axis);
-	auto shape_end   = subvec(input_shape, unpacked_axis + 1, input_shape.size());
+	auto array = std::array<Tensor, 1 + sizeof...(Tensors)>{ tensor, tensors... };
+	return implementation::_pack_fixed(array, std::string(pattern.view()), analyzed.n_axes_before, analyzed.n_axes_after);
+}
 
-	std::vector<TensorIndex> slice_filler;
-	for (auto&& _ : iters::range(unpacked_axis))
-		slice_filler.push_back(Slice(None, None));
+/// @brief Unpacks a single tensor with a pattern checked at compile time, e.g. auto [x, y, z] = unpack<"b * d">(packed, ps).
+/// @param tensor tensor to be unpacked.
+/// @param packed_shapes inline packed shapes, as returned by the fixed size pack
+/// @return array of tensors.
+template <implementation::PackPattern pattern, typename Tensor, size_t N>
+auto unpack(Tensor const& tensor, std::array<InlineShape, N> const& packed_shapes) -> std::array<Tensor, N>
+{
+	constexpr auto analyzed = implementation::_analyze_pack_pattern(pattern.view());
+	static_assert(analyzed.is_valid, "unpack pattern needs exactly one * and unique axis names");
 
-	try
-	{
-		std::vector<Tensor> output;
-		for (auto&& [i, element_shape] : iters::enumerate(packed_shapes))
-		{
-			auto slices = concat(slice_filler, Slice(split_positions[i], split_positions[i + 1]));
-			auto shapes = concat(shape_start, element_shape, shape_end);
-			output.push_back(backend.reshape(tensor.index(refarray(slices)), shapes));
-		}
-		return output;
-	}
-	catch (...)
-	{
-		throw Exception(format("Error during unpack(..., \"{}\"): could not split axis of size {}" \
-							   " into requested {}", pattern, split_positions.back(), implementation::print(packed_shapes)));
-	}
+	return implementation::_unpack_fixed(tensor, packed_shapes, std::string(pattern.view()), analyzed.n_axes_before, analyzed.n_axes_after);
 }
 
+#endif
+
 } // namespace einops
\ No newline at end of file
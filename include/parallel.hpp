@@ -0,0 +1,109 @@
+#pragma once
+
+#include <map>
+#include <memory>
+
+#include <einops.hpp>
+#include <extension/thread_pool.hpp>
+
+// The same pattern over many independent tensors. Tensors of the same shape share one
+// cooked recipe, recipes are prepared on the calling thread and only the backend calls
+// of every tensor run on the thread pool.
+
+namespace einops {
+namespace implementation {
+
+// pool of rearrange_many and reduce_many, the shared one of the library when not set
+inline auto _parallel_pool() -> std::unique_ptr<ThreadPool>&
+{
+	static std::unique_ptr<ThreadPool> pool;
+	return pool;
+}
+
+inline auto _get_parallel_pool() -> ThreadPool&
+{
+	auto&& pool = _parallel_pool();
+	return pool ? *pool : ThreadPool::global();
+}
+
+} // namespace implementation
+
+/// @brief Applies reduce() with the same pattern to every tensor, on a thread pool.
+/// Tensors of the same shape share their recipe, results keep the order of the inputs.
+/// @param tensors tensors of any supported library, of any shapes the pattern accepts
+/// @param pattern string, reduction pattern
+/// @param reduction one of available reductions ('min', 'max', 'sum', 'mean', 'prod'), case-sensitive
+/// @param axes_lengths any additional specifications for dimensions
+/// @return list of tensors, the result for each input, in order.
+template <typename Tensor, typename... Args>
+auto reduce_many(std::vector<Tensor> const& tensors, std::string const& pattern, std::string const& reduction, Args... axes_lengths) -> std::vector<Tensor>
+{
+	using namespace implementation;
+
+	std::vector<Tensor> results (tensors.size());
+	if (tensors.empty())
+		return results;
+
+	auto hashable_axes_lengths = _hashable_axes_lengths(axes_lengths...);
+	auto backend = std::get<0>(backends::get_backend(tensors.front()));
+
+	std::map<Shape, Axes> groups;
+	for (auto&& [i, tensor] : iters::enumerate(tensors))
+		groups[backend.shape(tensor)].push_back(i);
+
+	std::vector<std::tuple<std::shared_ptr<const TransformRecipe>, std::shared_ptr<const CookedRecipe>>> recipes;
+	std::vector<size_t> group_of (tensors.size());
+	for (auto&& [shape, members] : groups)
+	{
+		try
+		{
+			auto recipe = _prepare_transformation_recipe(pattern, reduction, hashable_axes_lengths, shape.size());
+			recipes.push_back({ recipe, _reconstruct_from_shape(*recipe, shape, hashable_axes_lengths) });
+		}
+		catch (Exception const& e)
+		{
+			auto message  = ::format("\n\n Error while processing {}-reduction pattern \"{}\".", reduction, pattern);
+				 message += ::format("\n Input tensor #{} shape: {}. ", print(members.front()), print(shape));
+				 message += ::format("Additional info: {}.", print(hashable_axes_lengths));
+			throw Exception(message + ::format("\n {}", e.what()));
+		}
+
+		for (auto member : members)
+			group_of[member] = recipes.size() - 1;
+	}
+
+	// pool threads run under the grad and inference modes of the caller
+	auto state = backend.thread_state();
+	_get_parallel_pool().parallel_for(tensors.size(), [&](size_t i)
+	{
+		typename decltype(backend)::ThreadStateGuard guard (state);
+		auto&& [recipe, cooked] = recipes[group_of[i]];
+		auto tensor_backend = backend; // backends are stateless, a copy per call keeps them apart
+		results[i] = _apply_cooked_recipe(tensor_backend, *recipe, *cooked, tensors[i], reduction);
+	});
+
+	return results;
+}
+
+/// @brief Applies rearrange() with the same pattern to every tensor, on a thread pool.
+/// Tensors of the same shape share their recipe, results keep the order of the inputs.
+/// @param tensors tensors of any supported library, of any shapes the pattern accepts
+/// @param pattern string, rearrangement pattern
+/// @param axes_lengths any additional specifications for dimensions
+/// @return list of tensors, the result for each input, in order.
+template <typename Tensor, typename... Args>
+auto rearrange_many(std::vector<Tensor> const& tensors, std::string const& pattern, Args... axes_lengths) -> std::vector<Tensor>
+{
+	return reduce_many(tensors, pattern, "rearrange", axes_lengths...);
+}
+
+/// @brief Sets the number of threads of rearrange_many and reduce_many, 0 goes back to the
+/// thread pool shared by the library. Not to be called while those are running.
+/// @param n_threads number of threads of the pool
+inline void set_parallel_threads(size_t n_threads)
+{
+	auto&& pool = implementation::_parallel_pool();
+	pool.reset(n_threads > 0 ? new implementation::ThreadPool(n_threads) : nullptr);
+}
+
+} // namespace einops
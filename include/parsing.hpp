@@ -1,5 +1,8 @@
 #pragma once
 
+#include <iostream>
+#include <mutex>
+
 #include <extension/python.hpp>
 
 namespace einops {
@@ -13,6 +16,7 @@ public:
 	bool has_ellipsis{ false };
 	bool has_ellipsis_parenthesized{ false };
 	bool has_non_unitary_anonymous_axes{ false };
+	std::vector<std::string> warnings; // kept with the expression, see report_warnings
 
 	using BracketGroup = std::vector<std::string>;
 
@@ -65,7 +69,7 @@ public:
 			
 					return;
 				} 
-				auto [is_axis_name, reason] = check_axis_name_return_reason(x, allow_underscore);
+				auto [is_axis_name, reason] = check_axis_name_return_reason(x, allow_underscore, &warnings);
 
 				if (!(is_number || is_axis_name))
 					throw Exception(format("Invalid axis identifier: {}\n{}", x, reason));
@@ -147,7 +151,25 @@ public:
 		return false;
 	}
 
-	static auto check_axis_name_return_reason(std::string const& name, bool allow_underscore = false) -> std::tuple<bool, std::string>
+	// printed by the callers that cache what they build from the expression, so that a
+	// pattern is reported once and parsing from several threads doesn't interleave output
+	void report_warnings() const
+	{
+		report_warnings(warnings);
+	}
+
+	static void report_warnings(std::vector<std::string> const& warnings)
+	{
+		if (warnings.empty())
+			return;
+
+		static std::mutex mutex;
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto&& warning : warnings)
+			std::cout << warning << std::endl;
+	}
+
+	static auto check_axis_name_return_reason(std::string const& name, bool allow_underscore = false, std::vector<std::string>* warnings = nullptr) -> std::tuple<bool, std::string>
 	{
 		if (!isidentifier(name))
 		{
@@ -163,11 +185,11 @@ public:
 		}
 		else
 		{
-			if (contains(python_keyword, name))
-				std::cout << ::format("It is discouraged to use axes names that are keywords: {}", name) << std::endl;
+			if (warnings && contains(python_keyword, name))
+				warnings->push_back(::format("It is discouraged to use axes names that are keywords: {}", name));
 
-			if (name == "axis")
-				std::cout << "It is discouraged to use 'axis' as an axis name and will raise an error in future" << std::endl;
+			if (warnings && name == "axis")
+				warnings->push_back("It is discouraged to use 'axis' as an axis name and will raise an error in future");
 
 			return std::make_tuple(true, "");
 		}
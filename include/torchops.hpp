@@ -0,0 +1,160 @@
+#pragma once
+
+#ifdef EINOPS_TORCH_BACKEND
+
+#include <einops.hpp>
+#include <torch/torch.h>
+#include <torch/csrc/jit/frontend/tracer.h>
+
+// einops::rearrange, einops::reduce and einops::repeat as operators of the torch registry,
+// so the tracer records a single node per call and saved graphs reload with their patterns.
+// Kernels are CompositeImplicitAutograd: autograd, meta tensors and shape propagation go
+// through the reshape, permute and reduce they are made of.
+//
+// The registration has to be compiled in a single translation unit, which defines
+// EINOPS_REGISTER_TORCH_OPS before including this header or layers/torch.hpp, which
+// includes it. Other units only call the ops. Once registered, the Rearrange and Reduce
+// layers call them while the tracer is on.
+
+namespace einops {
+namespace implementation {
+
+using TorchOpAxesLengths = c10::Dict<std::string, int64_t>;
+
+inline auto _from_torch_op_axes_lengths(TorchOpAxesLengths const& axes_lengths) -> AxesLengthsMap
+{
+	AxesLengthsMap output;
+	for (auto&& item : axes_lengths)
+		output[item.key()] = item.value();
+	return output;
+}
+
+inline auto _torch_op_axes_lengths(AxesLengths const& axes_lengths) -> TorchOpAxesLengths
+{
+	TorchOpAxesLengths output;
+	for (auto&& [axis, length] : axes_lengths)
+		output.insert(axis, length);
+	return output;
+}
+
+template <typename... Args>
+inline auto _to_torch_op_axes_lengths(Args... axes_lengths) -> TorchOpAxesLengths
+{
+	return _torch_op_axes_lengths(_hashable_axes_lengths(axes_lengths...));
+}
+
+inline auto _torch_op_string(c10::string_view value) -> std::string
+{
+	return std::string(value.data(), value.size());
+}
+
+inline auto _rearrange_op_kernel(at::Tensor const& x, c10::string_view pattern, TorchOpAxesLengths const& axes_lengths) -> at::Tensor
+{
+	return einops::reduce(x, _torch_op_string(pattern), "rearrange", _from_torch_op_axes_lengths(axes_lengths));
+}
+
+inline auto _reduce_op_kernel(at::Tensor const& x, c10::string_view pattern, c10::string_view reduction, TorchOpAxesLengths const& axes_lengths) -> at::Tensor
+{
+	return einops::reduce(x, _torch_op_string(pattern), _torch_op_string(reduction), _from_torch_op_axes_lengths(axes_lengths));
+}
+
+inline auto _repeat_op_kernel(at::Tensor const& x, c10::string_view pattern, TorchOpAxesLengths const& axes_lengths) -> at::Tensor
+{
+	return einops::reduce(x, _torch_op_string(pattern), "repeat", _from_torch_op_axes_lengths(axes_lengths));
+}
+
+template <typename Signature>
+inline auto _find_torch_op(char const* name)
+{
+	return c10::Dispatcher::singleton().findSchemaOrThrow(name, "").typed<Signature>();
+}
+
+inline auto _call_rearrange_op(at::Tensor const& x, std::string const& pattern, TorchOpAxesLengths const& axes_lengths) -> at::Tensor
+{
+	static auto op = _find_torch_op<at::Tensor(at::Tensor const&, c10::string_view, TorchOpAxesLengths const&)>("einops::rearrange");
+	return op.call(x, pattern, axes_lengths);
+}
+
+inline auto _call_reduce_op(at::Tensor const& x, std::string const& pattern, std::string const& reduction, TorchOpAxesLengths const& axes_lengths) -> at::Tensor
+{
+	static auto op = _find_torch_op<at::Tensor(at::Tensor const&, c10::string_view, c10::string_view, TorchOpAxesLengths const&)>("einops::reduce");
+	return op.call(x, pattern, reduction, axes_lengths);
+}
+
+inline auto _call_repeat_op(at::Tensor const& x, std::string const& pattern, TorchOpAxesLengths const& axes_lengths) -> at::Tensor
+{
+	static auto op = _find_torch_op<at::Tensor(at::Tensor const&, c10::string_view, TorchOpAxesLengths const&)>("einops::repeat");
+	return op.call(x, pattern, axes_lengths);
+}
+
+// layers are traced as a single operator call when the operators are registered,
+// by any translation unit of the program, and run their cooked recipes otherwise
+inline auto _traces_torch_ops() -> bool
+{
+	static auto registered = c10::Dispatcher::singleton().findSchema({ "einops::rearrange", "" }).has_value();
+	return registered && torch::jit::tracer::isTracing();
+}
+
+} // namespace implementation
+
+namespace ops {
+
+/// @brief rearrange() dispatched through the registered einops::rearrange operator.
+/// @param tensor torch tensor
+/// @param pattern string, rearrangement pattern
+/// @param axes_lengths any additional specifications for dimensions
+/// @return tensor of the same type as input.
+template <typename... Args>
+auto rearrange(torch::Tensor const& tensor, std::string const& pattern, Args... axes_lengths) -> torch::Tensor
+{
+	using namespace implementation;
+	return _call_rearrange_op(tensor, pattern, _to_torch_op_axes_lengths(axes_lengths...));
+}
+
+/// @brief reduce() dispatched through the registered einops::reduce operator.
+/// @param tensor torch tensor
+/// @param pattern string, reduction pattern
+/// @param reduction one of available reductions ('min', 'max', 'sum', 'mean', 'prod'), case-sensitive
+/// @param axes_lengths any additional specifications for dimensions
+/// @return tensor of the same type as input.
+template <typename... Args>
+auto reduce(torch::Tensor const& tensor, std::string const& pattern, std::string const& reduction, Args... axes_lengths) -> torch::Tensor
+{
+	using namespace implementation;
+	return _call_reduce_op(tensor, pattern, reduction, _to_torch_op_axes_lengths(axes_lengths...));
+}
+
+/// @brief repeat() dispatched through the registered einops::repeat operator.
+/// @param tensor torch tensor
+/// @param pattern string, rearrangement pattern
+/// @param axes_lengths any additional specifications for dimensions
+/// @return tensor of the same type as input.
+template <typename... Args>
+auto repeat(torch::Tensor const& tensor, std::string const& pattern, Args... axes_lengths) -> torch::Tensor
+{
+	using namespace implementation;
+	return _call_repeat_op(tensor, pattern, _to_torch_op_axes_lengths(axes_lengths...));
+}
+
+} // namespace ops
+} // namespace einops
+
+#ifdef EINOPS_REGISTER_TORCH_OPS
+
+TORCH_LIBRARY(einops, m)
+{
+	m.def("rearrange(Tensor x, str pattern, Dict(str, int) axes_lengths) -> Tensor");
+	m.def("reduce(Tensor x, str pattern, str reduction, Dict(str, int) axes_lengths) -> Tensor");
+	m.def("repeat(Tensor x, str pattern, Dict(str, int) axes_lengths) -> Tensor");
+}
+
+TORCH_LIBRARY_IMPL(einops, CompositeImplicitAutograd, m)
+{
+	m.impl("rearrange", &einops::implementation::_rearrange_op_kernel);
+	m.impl("reduce", &einops::implementation::_reduce_op_kernel);
+	m.impl("repeat", &einops::implementation::_repeat_op_kernel);
+}
+
+#endif // EINOPS_REGISTER_TORCH_OPS
+
+#endif // EINOPS_TORCH_BACKEND
@@ -97,6 +97,32 @@ public:
             auto y = rearrange(images, "b (h h1) (w w1) c -> b h w (c h1 w1)", axis("h1", 2), axis("w1", 2));
             TESTS(dump(y), dump({ 32, 15, 20, 12 }));
         }
+        {
+            // split fused projections into separate tensors, without the stacked intermediate
+            auto qkv = random({ 2, 10, 3 * 4 * 8 });
+            auto outputs = rearrange_split(qkv, "b n (three h d) -> three b h n d", axis("three", 3), axis("h", 4));
+            auto stacked = rearrange(qkv, "b n (three h d) -> three b h n d", axis("three", 3), axis("h", 4));
+            TESTB(outputs.size() == 3);
+            for (auto&& [i, output] : iters::enumerate(outputs))
+            {
+                TESTS(dump(output), dump({ 2, 4, 10, 8 }));
+                TESTB(output.equal(stacked.index({ int64_t(i) })));
+            }
+        }
+        {
+            // undo patchify, space-to-depth and head split with the forward patterns
+            auto batch = rearrange(images, "b h w c -> b h w c");
+            auto patches = rearrange(batch, "b (h p1) (w p2) c -> b (h w) (p1 p2 c)", axis("p1", 5), axis("p2", 5));
+            TESTB(batch.equal(inverse(patches, "b (h p1) (w p2) c -> b (h w) (p1 p2 c)", axis("h", 6), axis("p1", 5), axis("p2", 5))));
+
+            auto depth = rearrange(batch, "b (h h1) (w w1) c -> b h w (c h1 w1)", axis("h1", 2), axis("w1", 2));
+            TESTB(batch.equal(inverse(depth, "b (h h1) (w w1) c -> b h w (c h1 w1)", axis("h1", 2), axis("w1", 2))));
+
+            auto heads = random({ 2, 10, 4 * 8 });
+            auto split = rearrange(heads, "b n (h d) -> b h n d", axis("h", 4));
+            TESTB(heads.equal(inverse(split, "b n (h d) -> b h n d", axis("h", 4))));
+            TESTB(heads.equal(inverse(rearrange(heads, "b ... d -> d b ..."), "b ... d -> d b ...")));
+        }
     }
 
     void test_repeat()
@@ -134,8 +134,247 @@ public:
         }
     }
 
+    void test_contraction_path()
+    {
+        // contracting the two small operands first is 500x cheaper than left to right
+        auto optimizer = ContractionPathOptimizer({ "ab", "bc", "cd" }, "ad", { { 'a', 1000 }, { 'b', 2 }, { 'c', 1000 }, { 'd', 2 } });
+        for (auto&& path : { optimizer.optimal(), optimizer.greedy() })
+        {
+            TESTB(path.size() == 2);
+            TESTS(print(path[0].operands), print(Axes{ 1, 2 }));
+            TESTS(path[0].equation, "bc,cd->bd");
+            TESTS(path[1].equation, "ab,bd->ad");
+        }
+
+        // no pair fits in the memory limit, everything is contracted at once
+        auto limited = ContractionPathOptimizer({ "ab", "bc", "cd" }, "ad", { { 'a', 10 }, { 'b', 20 }, { 'c', 30 }, { 'd', 40 } }, 100);
+        TESTB(limited.optimize().size() == 1);
+
+        auto x = random({ 8, 2 });
+        auto y = random({ 2, 8 });
+        auto z = random({ 8, 2 });
+        auto w = random({ 2, 3 });
+        TESTB(torch::allclose(einsum("a b, b c, c d, d e -> a e", x, y, z, w), torch::einsum("ab,bc,cd,de->ae", { x, y, z, w }), 1e-4, 1e-5));
+    }
+
+    void test_composite_axes()
+    {
+        auto q = random({ 2, 5, 8 * 4 });
+        auto k = random({ 2, 7, 8 * 4 });
+        auto expected = torch::einsum("bnhd,bmhd->bhnm", { q.reshape({ 2, 5, 8, 4 }), k.reshape({ 2, 7, 8, 4 }) });
+
+        auto scores = einsum("b n (h d), b m (h d) -> b h n m", q, k, axis("h", 8));
+        TESTS(dump(scores), dump({ 2, 8, 5, 7 }));
+        TESTB(torch::allclose(scores, expected, 1e-4, 1e-5));
+
+        // output composition and singleton axes
+        auto merged = einsum("b n (h d), b m (h d) -> b n (h m) ()", q, k, axis("h", 8));
+        TESTS(dump(merged), dump({ 2, 5, 8 * 7, 1 }));
+
+        auto singleton = einsum("b () n, n -> b", random({ 3, 1, 4 }), random({ 4 }));
+        TESTS(dump(singleton), dump({ 3 }));
+
+        auto check_throws = [this](auto&& function)
+        {
+            try { function(); TESTB(false); } catch (...) { TESTB(true); }
+        };
+
+        // two unknown lengths in one composition
+        check_throws([&]() { return einsum("b n (h d), b m (h d) -> b h n m", q, k); });
+        // composition that can't be split
+        check_throws([&]() { return einsum("b n (h d), b m (h d) -> b h n m", q, k, axis("h", 5)); });
+        // unused axis length
+        check_throws([&]() { return einsum("b n c, b m c -> b n m", q, k, axis("h", 8)); });
+        // ellipsis inside parenthesis
+        check_throws([&]() { return einsum("b (...) -> b", q); });
+    }
+
+    void test_autotune()
+    {
+        const std::vector<std::tuple<std::string, std::vector<int64_t>, std::vector<int64_t>>> cases =
+        {
+            { "bij,bjk->bik", { 4, 5, 6 }, { 4, 6, 7 } },
+            { "ij,kj->ki",    { 5, 6 },    { 7, 6 } },
+            { "abc,cbd->da",  { 2, 3, 4 }, { 4, 3, 5 } },
+            { "bhnd,bhmd->bhnm", { 2, 3, 4, 5 }, { 2, 3, 6, 5 } },
+        };
+
+        auto backend = TorchBackend();
+        for (auto&& [equation, lhs_shape, rhs_shape] : cases)
+        {
+            auto x = random(lhs_shape);
+            auto y = random(rhs_shape);
+            auto expected = torch::einsum(equation, { x, y });
+
+            // every lowering gives the same result
+            auto plan = _prepare_gemm_lowering(equation, lhs_shape, rhs_shape);
+            TESTB(plan.has_value());
+            TESTB(torch::allclose(_contract_pair_with(backend, { EinsumLowering::bmm, plan, {} }, equation, x, y), expected, 1e-4, 1e-5));
+            if (!plan.value().has_batch)
+                TESTB(torch::allclose(_contract_pair_with(backend, { EinsumLowering::tensordot, plan, {} }, equation, x, y), expected, 1e-4, 1e-5));
+        }
+
+        // traces are not lowered
+        TESTB(!_prepare_gemm_lowering("ii,ij->j", { 3, 3 }, { 3, 4 }).has_value());
+
+        set_einsum_autotune(true);
+        auto x = random({ 4, 5, 6 });
+        auto y = random({ 4, 6, 7 });
+        auto tuned = einsum("b i j, b j k -> b i k", x, y);
+        auto again = einsum("b i j, b j k -> b i k", x, y);
+        set_einsum_autotune(false);
+
+        TESTB(torch::allclose(tuned, torch::bmm(x, y), 1e-4, 1e-5));
+        TESTB(torch::allclose(again, torch::bmm(x, y), 1e-4, 1e-5));
+
+        auto decisions = einsum_autotune_decisions();
+        TESTB(decisions.size() == 1);
+        TESTB(decisions.begin()->second.timings.size() == 3);
+
+        // a single candidate is stored untimed, decisions are kept per device
+        auto square = random({ 3, 3 });
+        auto w = random({ 3, 4 });
+        set_einsum_autotune(true);
+        auto traced = einsum("i i, i j -> j", square, w);
+        set_einsum_autotune(false);
+
+        TESTB(torch::allclose(traced, torch::einsum("ii,ij->j", { square, w }), 1e-4, 1e-5));
+
+        decisions = einsum_autotune_decisions();
+        TESTB(decisions.size() == 2);
+        for (auto&& [key, decision] : decisions)
+        {
+            TESTB(key.find("cpu") != std::string::npos);
+            if (key.find("ii,ij->j") != std::string::npos)
+                TESTB(decision.timings.empty() && decision.lowering == EinsumLowering::einsum);
+        }
+    }
+
+    void test_engines()
+    {
+        // operands already in GEMM layout are not transposed
+        auto plan = _prepare_gemm_lowering("bij,bjk->bik", { 4, 5, 6 }, { 4, 6, 7 });
+        TESTB(plan.value().lhs_in_layout && plan.value().rhs_in_layout && plan.value().output_in_layout);
+        plan = _prepare_gemm_lowering("bhnd,bhmd->bhnm", { 2, 3, 4, 5 }, { 2, 3, 6, 5 });
+        TESTB(!plan.value().lhs_in_layout && !plan.value().rhs_in_layout && plan.value().output_in_layout);
+
+        auto x = random({ 2, 3, 4, 5 });
+        auto y = random({ 2, 3, 6, 5 });
+        auto z = random({ 6, 7 });
+        auto expected = torch::einsum("bhnd,bhmd,mk->bnhk", { x, y, z });
+
+        set_einsum_engine("ttgt");
+        auto result = einsum("b h n d, b h m d, m k -> b n h k", x, y, z);
+        auto matrix = random({ 4, 4 });
+        auto trace = einsum("i i ->", matrix);
+        set_einsum_engine("backend");
+
+        TESTB(torch::allclose(result, expected, 1e-4, 1e-5));
+        TESTS(dump(trace), "()");
+        TESTB(torch::allclose(trace, matrix.trace(), 1e-4, 1e-5));
+
+        try { set_einsum_engine("blas"); TESTB(false); } catch (...) { TESTB(true); }
+    }
+
+    void test_constants()
+    {
+        auto split = _split_constant_equation("ab,bc,cd->ad", { false, true, true }, { { 8, 5 }, { 5, 6 }, { 6, 7 } });
+        TESTB(split.has_value());
+        TESTS(print(split.value().equations), "[bc,cd->bd]");
+        TESTS(split.value().equation, "ab,bd->ad");
+        TESTB(!_split_constant_equation("ab,bc->ac", { false, true }, { { 8, 5 }, { 5, 6 } }).has_value());
+
+        // constants sharing no index are not multiplied together
+        TESTB(!_split_constant_equation("ij,bjk,kl->bil", { true, false, true }, { { 4, 5 }, { 2, 5, 6 }, { 6, 3 } }).has_value());
+        split = _split_constant_equation("ij,jm,bmk,kn,nl->bil", { true, true, false, true, true }, { { 4, 5 }, { 5, 2 }, { 3, 2, 6 }, { 6, 2 }, { 2, 3 } });
+        TESTS(print(split.value().equations), "[ij,jm->im, kn,nl->kl]");
+        TESTS(split.value().equation, "bmk,im,kl->bil");
+
+        // nor contracted when the result outgrows its operands
+        TESTB(!_split_constant_equation("xac,ab,bd->xcd", { false, true, true }, { { 2, 10, 3 }, { 10, 1 }, { 1, 10 } }).has_value());
+
+        auto x = random({ 8, 5 });
+        auto w1 = random({ 5, 6 });
+        auto w2 = random({ 6, 7 });
+        auto expected = torch::einsum("bi,ij,jk->bk", { x, w1, w2 });
+
+        auto first = einsum("b i, i j, j k -> b k", x, constant(w1), constant(w2));
+        auto second = einsum("b i, i j, j k -> b k", x, constant(w1), constant(w2));
+        TESTB(torch::allclose(first, expected, 1e-4, 1e-5));
+        TESTB(torch::allclose(second, expected, 1e-4, 1e-5));
+
+        // in-place updates of a constant invalidate its pre-contraction
+        w1.add_(1);
+        auto updated = einsum("b i, i j, j k -> b k", x, constant(w1), constant(w2));
+        TESTB(torch::allclose(updated, torch::einsum("bi,ij,jk->bk", { x, w1, w2 }), 1e-4, 1e-5));
+
+        auto input = random({ 2, 5, 6 });
+        auto left = random({ 4, 5 });
+        auto right = random({ 6, 3 });
+        auto disconnected = einsum("i j, b j k, k l -> b i l", constant(left), input, constant(right));
+        TESTB(torch::allclose(disconnected, torch::einsum("ij,bjk,kl->bil", { left, input, right }), 1e-4, 1e-5));
+
+        // constants recorded by autograd are contracted again on every call
+        auto trained = random({ 5, 6 });
+        trained.set_requires_grad(true);
+        auto gradient = torch::einsum("bi,jk->ij", { x, w2 });
+        for (auto n : { 1, 2 })
+        {
+            einsum("b i, i j, j k -> b k", x, constant(trained), constant(w2)).sum().backward();
+            TESTB(torch::allclose(trained.grad(), gradient.mul(n), 1e-4, 1e-5));
+        }
+
+        // composite axes of constants are split before the pre-contraction
+        auto w3 = random({ 2 * 3, 7 });
+        auto composite = einsum("b h, (h d) k -> b d", random({ 4, 2 }), constant(w3), axis("d", 3));
+        TESTS(dump(composite), dump({ 4, 3 }));
+    }
+
+    void test_batched()
+    {
+        auto query = random({ 16 });
+        std::vector<std::tuple<torch::Tensor, torch::Tensor>> candidates;
+        for (auto n : { 5, 5, 7, 5 })
+            candidates.push_back({ query, random({ n, 16 }) });
+
+        auto scores = einsum_batched("d, n d -> n", candidates);
+        TESTB(scores.size() == candidates.size());
+        for (auto&& [score, candidate] : iters::zip(scores, candidates))
+            TESTB(torch::allclose(score, torch::einsum("d,nd->n", { std::get<0>(candidate), std::get<1>(candidate) }), 1e-4, 1e-5));
+
+        // composite axes are split in every operand set
+        std::vector<std::tuple<torch::Tensor, torch::Tensor>> heads;
+        for (auto _ : iters::range(3))
+            heads.push_back({ random({ 2, 4 * 8 }), random({ 3, 4 * 8 }) });
+        auto attention = einsum_batched("n (h d), m (h d) -> h n m", heads, axis("h", 4));
+        for (auto&& [result, operands] : iters::zip(attention, heads))
+            TESTB(torch::allclose(result, einsum("n (h d), m (h d) -> h n m", std::get<0>(operands), std::get<1>(operands), axis("h", 4)), 1e-4, 1e-5));
+
+        // sets of the very same operands are contracted once, each set still gets its own result
+        auto k = random({ 3, 4 * 8 });
+        std::vector<std::tuple<torch::Tensor, torch::Tensor>> duplicates { { std::get<0>(heads[0]), k }, { std::get<0>(heads[0]), k } };
+        auto repeated = einsum_batched("n (h d), m (h d) -> h n m", duplicates, axis("h", 4));
+        TESTB(repeated.size() == 2);
+        for (auto&& result : repeated)
+            TESTB(torch::allclose(result, einsum("n (h d), m (h d) -> h n m", std::get<0>(heads[0]), k, axis("h", 4)), 1e-4, 1e-5));
+        repeated[0].zero_();
+        TESTB(!torch::allclose(repeated[0], repeated[1]));
+
+        // operand sets of the same shapes but different dtypes are not stacked together
+        std::vector<std::tuple<torch::Tensor, torch::Tensor>> mixed { { query, random({ 5, 16 }) }, { query.to(torch::kFloat64), random({ 5, 16 }).to(torch::kFloat64) } };
+        auto typed = einsum_batched("d, n d -> n", mixed);
+        TESTB(typed[0].dtype() == torch::kFloat32);
+        TESTB(typed[1].dtype() == torch::kFloat64);
+    }
+
     void test_list() final
     {
         test_functional();
+        test_contraction_path();
+        test_composite_axes();
+        test_autotune();
+        test_engines();
+        test_constants();
+        test_batched();
     }
 };
\ No newline at end of file
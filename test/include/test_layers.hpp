@@ -0,0 +1,129 @@
+#pragma once
+
+#include "test_tools.hpp"
+#include <layers/torch.hpp>
+
+#define CATCH(a) { try { a; TESTB(false);  } catch(...) { TESTB(true); } }
+
+class LayersTest : public UnitTest
+{
+public:
+    LayersTest()
+        : UnitTest("Layers")
+    {}
+
+    void test_rearrange()
+    {
+        auto layer = Rearrange("b c (h h2) (w w2) -> b (c h2 w2) h w", axis("h2", 2), axis("w2", 2));
+        auto x = rand({ 2, 3, 8, 10 });
+        auto expected = rearrange(x, "b c (h h2) (w w2) -> b (c h2 w2) h w", axis("h2", 2), axis("w2", 2));
+
+        // the second call on the same shape takes the cooked recipe of the first one
+        for (auto _ : iters::range(2))
+            TESTB(layer->forward(x).equal(expected));
+
+        auto y = rand({ 4, 3, 4, 4 });
+        TESTB(layer->forward(y).equal(rearrange(y, "b c (h h2) (w w2) -> b (c h2 w2) h w", axis("h2", 2), axis("w2", 2))));
+        TESTB(layer->forward(x).equal(expected));
+
+        auto permute = Rearrange("b ... c -> b c ...");
+        TESTS(print(permute->forward(rand({ 2, 3, 4, 5 })).sizes().vec()), print(Shape{ 2, 5, 3, 4 }));
+
+        // recipes are prepared on first use, for any rank
+        auto flatten = Rearrange("b ... -> b (...)");
+        TESTS(print(flatten->forward(rand({ 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 3 })).sizes().vec()), print(Shape{ 2, 3 }));
+        TESTS(print(flatten->forward(rand({ 2, 3, 4 })).sizes().vec()), print(Shape{ 2, 12 }));
+        CATCH(Rearrange("b c h w -> b (c h w)")->forward(rand({ 2, 3, 4 })));
+    }
+
+    void test_reduce()
+    {
+        auto layer = Reduce("b c (h h2) (w w2) -> b c h w", "max", axis("h2", 2), axis("w2", 2));
+        auto x = rand({ 2, 3, 8, 10 });
+        for (auto _ : iters::range(2))
+            TESTB(layer->forward(x).equal(reduce(x, "b c (h h2) (w w2) -> b c h w", "max", axis("h2", 2), axis("w2", 2))));
+
+        CATCH(layer->forward(rand({ 2, 3, 7, 10 })));
+    }
+
+    void test_tracing()
+    {
+        // with the operators registered, traced layers are single einops nodes
+        auto flatten = Rearrange("b c (h h2) w -> b (c h2) h w", axis("h2", 2));
+        auto pool = Reduce("b c h w -> b c", "mean");
+        auto x = rand({ 2, 3, 4, 5 });
+
+        auto traced = torch::jit::tracer::trace({ x }, [&](torch::jit::Stack inputs) -> torch::jit::Stack
+        {
+            return { pool->forward(flatten->forward(inputs[0].toTensor())) };
+        }, [](torch::Tensor const&) { return std::string(); }, false);
+
+        auto graph = std::get<0>(traced)->graph->toString();
+        TESTB(graph.find("einops::rearrange") != std::string::npos);
+        TESTB(graph.find("einops::reduce") != std::string::npos);
+        TESTB(graph.find("aten::permute") == std::string::npos);
+        TESTB(std::get<1>(traced)[0].toTensor().equal(pool->forward(flatten->forward(x))));
+    }
+
+    void test_einmix()
+    {
+        {
+            auto layer = EinMix("b t c -> b t d", "c d", "d", axis("c", 4), axis("d", 5));
+            auto x = rand({ 2, 3, 4 });
+            auto expected = einsum("b t c, c d -> b t d", x, layer->weight()) + layer->bias();
+            TESTB(torch::allclose(layer->forward(x), expected));
+        }
+        {
+            // heads are batch axes of the product, the weight is stored as h c d
+            auto layer = EinMix("b n (h c) -> b n (h d)", "d c h", "h d", axis("h", 2), axis("c", 3), axis("d", 4));
+            TESTS(print(layer->weight_layout()), print(AxesNames{ "h", "c", "d" }));
+
+            auto x = rand({ 2, 5, 6 });
+            auto y = einsum("b n h c, h c d -> b n h d", rearrange(x, "b n (h c) -> b n h c", axis("h", 2)), layer->weight()) + layer->bias();
+            TESTB(torch::allclose(layer->forward(x), rearrange(y, "b n h d -> b n (h d)")));
+        }
+        {
+            // t is summed over without the weight, the layer falls back to einsum
+            auto layer = EinMix("b t c -> b d", "c d", "", axis("c", 4), axis("d", 5));
+            auto x = rand({ 2, 3, 4 });
+            TESTB(torch::allclose(layer->forward(x), einsum("b t c, c d -> b d", x, layer->weight())));
+        }
+        CATCH(EinMix("b c -> b d", "c", "", axis("c", 3)));
+        CATCH(EinMix("b c -> b d", "c d", "", axis("c", 3)));
+        CATCH(EinMix("b c -> b d", "c d", "e", axis("c", 3), axis("d", 4)));
+    }
+
+    void test_fusion()
+    {
+        auto model = torch::nn::Sequential(
+            Rearrange("b c (h h2) (w w2) -> b h w (c h2 w2)", axis("h2", 2), axis("w2", 2)),
+            Rearrange("b h w c -> b c h w"),
+            Reduce("b c h w -> b c", "mean"),
+            Reduce("b c -> c", "max"),
+            torch::nn::Sequential(Rearrange("c -> c ()"), Rearrange("c x -> x c")));
+
+        auto x = rand({ 2, 3, 8, 10 });
+        auto expected = model->forward(x);
+
+        auto report = fuse_einops_layers(model);
+        TESTB(report.size() == 2);
+        TESTB(model->size() == 3);
+        TESTB(model->forward(x).equal(expected));
+
+        // (h w) split as (w h) is not a permutation of the input, the layers run one by one
+        auto layer = FusedRecipe(std::vector<FusedStage>{
+            _fused_stage(Rearrange("b h w -> b (h w)").ptr()).value(),
+            _fused_stage(Rearrange("b (w h) -> b h w", axis("w", 3)).ptr()).value() });
+        auto y = rand({ 2, 2, 3 });
+        TESTB(layer->forward(y).equal(rearrange(rearrange(y, "b h w -> b (h w)"), "b (w h) -> b h w", axis("w", 3))));
+    }
+
+    void test_list() final
+    {
+        test_rearrange();
+        test_reduce();
+        test_tracing();
+        test_einmix();
+        test_fusion();
+    }
+};
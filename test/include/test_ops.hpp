@@ -2,6 +2,13 @@
 
 #include "test_tools.hpp"
 
+// the test executable is the single unit registering the torch operators
+#define EINOPS_REGISTER_TORCH_OPS
+#include <torchops.hpp>
+#include <autograd.hpp>
+#include <parallel.hpp>
+#include <async.hpp>
+
 const std::vector<std::string> identity_patterns =
 {
     "...->...",
@@ -54,8 +61,200 @@ public:
                 TESTB(array_equal(reduce(x, pattern1, reduction), reduce(x, pattern2, reduction)));
     }
 
+    void test_kernel_families()
+    {
+        const std::vector<std::tuple<std::string, std::vector<int64_t>, AxesLengths, KernelFamily>> cases =
+        {
+            { "a b c -> a b c",                         { 2, 3, 4 },        {},                             KernelFamily::identity },
+            { "a b c -> a (b c)",                       { 2, 3, 4 },        {},                             KernelFamily::view },
+            { "h w -> w h",                             { 3, 4 },           {},                             KernelFamily::transpose },
+            { "b h w -> b w h",                         { 2, 3, 4 },        {},                             KernelFamily::batched_transpose },
+            { "a b c -> c a b",                         { 2, 3, 4 },        {},                             KernelFamily::permute },
+            { "b n (h d) -> b h n d",                   { 2, 5, 12 },       { { "h", 3 } },                 KernelFamily::head_split },
+            { "b h n d -> b n (h d)",                   { 2, 3, 5, 4 },     {},                             KernelFamily::head_merge },
+            { "b (c h2 w2) h w -> b c (h h2) (w w2)",   { 2, 12, 3, 5 },    { { "h2", 2 }, { "w2", 2 } },   KernelFamily::pixel_shuffle },
+            { "b c (h h2) (w w2) -> b (c h2 w2) h w",   { 2, 3, 6, 10 },    { { "h2", 2 }, { "w2", 2 } },   KernelFamily::pixel_unshuffle },
+            { "b c (h h2) (w w2) -> b (c h2 w2) h w",   { 2, 3, 6, 9 },     { { "h2", 2 }, { "w2", 3 } },   KernelFamily::pixel_unshuffle },
+            { "b c (h p1) (w p2) -> b (h w) (p1 p2 c)", { 2, 3, 8, 8 },     { { "p1", 4 }, { "p2", 4 } },   KernelFamily::patchify },
+            { "b c h w -> b c h",                       { 2, 3, 4, 5 },     {},                             KernelFamily::generic },
+        };
+
+        for (auto&& [pattern, shape, axes_lengths, family] : cases)
+        {
+            auto x = arange_and_reshape(_product(shape), shape);
+            auto operation = family == KernelFamily::generic ? "sum" : "rearrange";
+            auto [backend, _] = get_backend(x);
+
+            auto recipe = *_prepare_transformation_recipe(pattern, operation, axes_lengths, shape.size());
+            TESTS(print(recipe.family), print(family));
+
+            auto generic = recipe;
+                 generic.family = KernelFamily::generic;
+            TESTB(torch::equal(_apply_recipe(backend, recipe, x, operation, axes_lengths),
+                               _apply_recipe(backend, generic, x, operation, axes_lengths)));
+        }
+
+        // inverse recipes keep the order of the forward groups, and so the kernel family
+        const std::vector<std::tuple<std::string, int64_t, AxesLengths, KernelFamily>> inverses =
+        {
+            { "b c (h h2) (w w2) -> b (c h2 w2) h w",   4,  { { "h2", 2 }, { "w2", 2 } },   KernelFamily::pixel_shuffle },
+            { "b (c h2 w2) h w -> b c (h h2) (w w2)",   4,  { { "h2", 2 }, { "w2", 2 } },   KernelFamily::pixel_unshuffle },
+            { "b n (h d) -> b h n d",                   4,  { { "h", 3 } },                 KernelFamily::head_merge },
+            { "b h n d -> b n (h d)",                   3,  { { "h", 3 } },                 KernelFamily::head_split },
+        };
+
+        for (auto&& [pattern, ndim, axes_lengths, family] : inverses)
+            TESTS(print(_prepare_inverse_recipe(pattern, axes_lengths, ndim)->family), print(family));
+    }
+
+    void test_torch_ops()
+    {
+        auto x = arange_and_reshape({ 2 * 3 * 4 * 6 }, { 2, 3, 4, 6 }).to(torch::kFloat32);
+
+        TESTB(torch::equal(ops::rearrange(x, "b c h w -> b (c h w)"), rearrange(x, "b c h w -> b (c h w)")));
+        TESTB(torch::equal(ops::reduce(x, "b c h (w w2) -> b c h w", "max", axis("w2", 2)), reduce(x, "b c h (w w2) -> b c h w", "max", axis("w2", 2))));
+        TESTB(torch::equal(ops::repeat(x, "b c h w -> b c h w r", axis("r", 3)), repeat(x, "b c h w -> b c h w r", axis("r", 3))));
+
+        // shapes propagate through meta tensors, nothing is computed
+        auto meta = torch::empty({ 2, 3, 4, 6 }, torch::TensorOptions().device(torch::kMeta));
+        TESTS(print(ops::rearrange(meta, "b c (h h2) w -> b (c h2) h w", axis("h2", 2)).sizes().vec()), print(Shape{ 2, 6, 2, 6 }));
+    }
+
+    void test_autograd()
+    {
+        // same values and gradients as the chain of autograd nodes of the functional ops
+        auto check_gradient = [this](std::string const& pattern, std::string const& reduction, auto... axes_lengths)
+        {
+            auto x = torch::rand({ 2, 4, 6 });
+            x.set_requires_grad(true);
+
+            auto y = autograd::reduce(x, pattern, reduction, axes_lengths...);
+            auto z = reduce(x, pattern, reduction, axes_lengths...);
+            auto g = torch::rand(z.sizes());
+            TESTB(torch::allclose(y, z));
+            TESTB(torch::allclose(torch::autograd::grad({ y }, { x }, { g })[0], torch::autograd::grad({ z }, { x }, { g })[0]));
+        };
+
+        check_gradient("b h w -> w b h", "rearrange");
+        check_gradient("b (h h2) (w w2) -> b (w h2) h w2", "rearrange", axis("h2", 2), axis("w2", 3));
+        check_gradient("b h w -> b h w c", "repeat", axis("c", 3));
+        check_gradient("b h w -> (w r) b h", "repeat", axis("r", 2));
+        check_gradient("b (h h2) w -> w b h", "sum", axis("h2", 2));
+        check_gradient("b h w -> h", "mean");
+        check_gradient("b h w -> w () b", "max");
+    }
+
+    void test_many()
+    {
+        // shapes repeat, so some tensors share their recipe
+        std::vector<torch::Tensor> tensors;
+        for (auto&& length : { 4, 6, 4, 8, 6, 4 })
+            tensors.push_back(torch::rand({ 3, length, 10 }));
+
+        auto check_results = [&](std::vector<torch::Tensor> const& results, auto&& function)
+        {
+            TESTB(results.size() == tensors.size());
+            for (auto&& [tensor, result] : iters::zip(tensors, results))
+                TESTB(result.equal(function(tensor)));
+        };
+
+        check_results(rearrange_many(tensors, "b (t t2) c -> t b (t2 c)", axis("t2", 2)), [](auto&& x) { return rearrange(x, "b (t t2) c -> t b (t2 c)", axis("t2", 2)); });
+        check_results(reduce_many(tensors, "b t c -> b c", "max"), [](auto&& x) { return reduce(x, "b t c -> b c", "max"); });
+
+        set_parallel_threads(2);
+        check_results(reduce_many(tensors, "b t c -> c b", "sum"), [](auto&& x) { return reduce(x, "b t c -> c b", "sum"); });
+        set_parallel_threads(0);
+
+        TESTB(rearrange_many(std::vector<torch::Tensor>(), "b c -> c b").empty());
+        try { rearrange_many(tensors, "b (t t2) c -> t b (t2 c)", axis("t2", 4)); TESTB(false); } catch (...) { TESTB(true); }
+
+        // pool threads run under the grad and inference modes of the caller
+        std::vector<torch::Tensor> trained = { torch::rand({ 3, 4, 10 }), torch::rand({ 3, 6, 10 }) };
+        for (auto&& tensor : trained)
+            tensor.set_requires_grad(true);
+        {
+            torch::NoGradGuard no_grad;
+            for (auto&& result : reduce_many(trained, "b t c -> b c", "sum"))
+                TESTB(!result.requires_grad());
+        }
+        {
+            torch::InferenceMode inference;
+            for (auto&& result : reduce_many(tensors, "b t c -> b c", "sum"))
+                TESTB(result.is_inference());
+        }
+    }
+
+    void test_async()
+    {
+        auto x = torch::rand({ 4, 6, 8 });
+        auto w = torch::rand({ 8, 5 });
+
+        // issued on the same tensor, computed one after another
+        std::vector<std::future<torch::Tensor>> futures;
+        for (auto&& h2 : { 1, 2, 3, 6 })
+            futures.push_back(rearrange_async(x, "b (h h2) c -> b h (h2 c)", axis("h2", h2)));
+        for (auto&& [h2, future] : iters::zip(std::vector<int64_t>{ 1, 2, 3, 6 }, futures))
+            TESTB(future.get().equal(rearrange(x, "b (h h2) c -> b h (h2 c)", axis("h2", h2))));
+
+        TESTB(reduce_async(x, "b h c -> b c", "max").get().equal(reduce(x, "b h c -> b c", "max")));
+        TESTB(repeat_async(w, "c d -> c d r", axis("r", 2)).get().equal(repeat(w, "c d -> c d r", axis("r", 2))));
+        TESTB(torch::allclose(einsum_async("b h c, c d -> b h d", x, w).get(), einsum("b h c, c d -> b h d", x, w)));
+
+        // errors are held by the future
+        auto failed = rearrange_async(x, "b (h h2) c -> b h (h2 c)", axis("h2", 4));
+        try { failed.get(); TESTB(false); } catch (...) { TESTB(true); }
+
+        // computed under the grad mode the call was issued with
+        auto trained = torch::rand({ 4, 6, 8 });
+        trained.set_requires_grad(true);
+        std::future<torch::Tensor> detached;
+        {
+            torch::NoGradGuard no_grad;
+            detached = reduce_async(trained, "b h c -> b c", "sum");
+        }
+        TESTB(!detached.get().requires_grad());
+        TESTB(reduce_async(trained, "b h c -> b c", "sum").get().requires_grad());
+    }
+
+    void test_caches()
+    {
+        auto x = torch::rand({ 2, 3, 4 });
+        auto expected = rearrange(x, "b c h -> h (b c)");
+
+        // recipes copied by this thread are dropped with the shared ones
+        clear_caches();
+        TESTB(rearrange(x, "b c h -> h (b c)").equal(expected));
+
+        set_recipe_cache_sizes(1, 1);
+        TESTB(rearrange(x, "b c h -> h (b c)").equal(expected));
+        TESTB(rearrange(x, "b c h -> (b c) h").equal(expected.t()));
+        TESTB(rearrange(x, "b c h -> h (b c)").equal(expected));
+        set_recipe_cache_sizes(256, 1024);
+
+        // the slot of this thread is stale once the shared cache is cleared or resized
+        LRUCache<int64_t, int64_t> cache (4);
+        cache.put(1, 10);
+        TESTB(*cache.find_local(1) == 10);
+        cache.clear();
+        TESTB(!cache.find_local(1));
+        cache.put(1, 20);
+        TESTB(*cache.find_local(1) == 20);
+        cache.resize(2);
+        cache.put(1, 30);
+        TESTB(*cache.find_local(1) == 30);
+
+        // hits of the slot share the value held by the cache
+        TESTB(cache.find_local(1) == cache.find(1));
+    }
+
     void test_list() final
     {
         test_ellipsis_ops();
+        test_kernel_families();
+        test_torch_ops();
+        test_autograd();
+        test_many();
+        test_async();
+        test_caches();
     }
 };
\ No newline at end of file
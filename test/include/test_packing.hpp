@@ -134,9 +134,198 @@ public:
         }
     }
 
+    void test_pack_plan()
+    {
+        auto a = rand({ 4, 2, 3 });
+        auto b = rand({ 4, 5 });
+        auto&& [packed, ps] = pack(Tensors{ a, b }, "batch *");
+
+        auto plan = PackPlan("batch *", ps);
+        TESTS(print(plan.lengths()), "{ 6, 5 }");
+        TESTS(print(plan.offsets()), "{ 0, 6 }");
+        TESTB(plan.axis() == 1);
+
+        // the plan is reused for other batches of the same layout
+        for (auto batch : { 4, 7 })
+        {
+            auto x = rand({ batch, 11 });
+            auto unpacked = unpack(x, plan);
+            TESTB(unpacked.size() == 2);
+            TESTS(print(unpacked[0].sizes().vec()), print(Shape{ batch, 2, 3 }));
+            TESTB(unpacked[0].data_ptr() == x.data_ptr());
+            TESTB(pack(unpacked, plan).equal(x));
+        }
+
+        // inputs are checked against the packed shapes of the plan
+        CATCH(plan.pack(Tensors{ rand({ 4, 5 }), rand({ 4, 2, 3 }) }));
+        CATCH(plan.pack_into(torch::empty({ 4, 11 }), Tensors{ rand({ 4, 5 }), rand({ 4, 2, 3 }) }));
+        CATCH(PackPlan("batch *", {}).pack(Tensors{}));
+
+        // the -1 slot is resolved on each call
+        auto inferred = PackPlan("batch *", { { 2, -1 }, { 5 } });
+        TESTB(inferred.offsets().empty());
+        TESTS(print(unpack(rand({ 4, 11 }), inferred)[0].sizes().vec()), print(Shape{ 4, 2, 3 }));
+        CATCH(unpack(rand({ 4, 10 }), inferred));
+        TESTS(print(inferred.pack(Tensors{ rand({ 4, 2, 7 }), rand({ 4, 5 }) }).sizes().vec()), print(Shape{ 4, 19 }));
+        CATCH(PackPlan("batch *", { { -1 }, { -1 } }));
+    }
+
+    void test_pack_into()
+    {
+        auto a = rand({ 4, 2, 3 });
+        auto b = rand({ 4, 5 });
+        {
+            auto out = torch::empty({ 4, 11 });
+            auto plan = pack_into(out, Tensors{ a, b }, "batch *");
+            TESTB(out.equal(pack_t({ a, b }, "batch *")));
+            TESTB(unpack(out, plan)[0].equal(a));
+        }
+        {
+            // slots start at multiples of 4, the padding is not written
+            auto out = torch::full({ 4, 16 }, -1.0);
+            auto plan = pack_into(out, Tensors{ a, b }, "batch *", 4);
+            TESTS(print(plan.offsets()), "{ 0, 8 }");
+            TESTB(plan.packed_length() == 16);
+            TESTB(out.narrow(1, 6, 2).equal(torch::full({ 4, 2 }, -1.0)));
+            TESTB(out.narrow(1, 13, 3).equal(torch::full({ 4, 3 }, -1.0)));
+
+            auto unpacked = unpack(out, plan);
+            TESTB(unpacked[0].equal(a));
+            TESTB(unpacked[1].equal(b));
+
+            CATCH(pack_into(torch::empty({ 4, 13 }), Tensors{ a, b }, "batch *", 4));
+            CATCH(plan.pack(Tensors{ a, b }));
+        }
+    }
+
+    void test_parallel()
+    {
+        Tensors tensors;
+        for (auto i : iters::range(50))
+            tensors.push_back(rand({ 3, i % 7 + 1, 5 }));
+        tensors.push_back(rand({ 3, 400, 5 }));
+
+        auto expected = pack_t(tensors, "a * b");
+
+        // small chunks so that the large tensor is split as well
+        set_pack_parallel(true, 64);
+        auto&& [packed, ps] = pack(tensors, "a * b");
+        auto unpacked = unpack_contiguous(packed, PackPlan("a * b", ps));
+        set_pack_parallel(false);
+
+        TESTB(packed.equal(expected));
+        for (auto&& [output, tensor] : iters::zip(unpacked, tensors))
+        {
+            TESTB(output.is_contiguous());
+            TESTB(output.equal(tensor));
+        }
+
+        // copies recorded by autograd run sequentially, pool threads follow the grad mode of the caller
+        auto trained = rand({ 3, 400, 5 });
+        trained.set_requires_grad(true);
+        set_pack_parallel(true, 64);
+        auto&& [recorded, _] = pack(Tensors{ trained, tensors.front() }, "a * b");
+        recorded.sum().backward();
+        TESTB(trained.grad().equal(torch::ones({ 3, 400, 5 })));
+        {
+            torch::NoGradGuard no_grad;
+            auto&& [detached, _] = pack(Tensors{ trained, tensors.front() }, "a * b");
+            TESTB(!detached.requires_grad());
+        }
+        set_pack_parallel(false);
+    }
+
+    void test_ragged()
+    {
+        Tensors sequences = { rand({ 3, 8 }), rand({ 5, 8 }), rand({ 1, 8 }) };
+
+        auto ragged = pack_ragged(sequences, "* d", true);
+        TESTS(dump(ragged.packed), dump({ 9, 8 }));
+        TESTB(ragged.cu_seqlens.scalar_type() == torch::kInt32);
+        TESTB(ragged.cu_seqlens.equal(torch::tensor({ 0, 3, 8, 9 }, torch::TensorOptions().dtype(torch::kInt32))));
+        TESTB(ragged.segment_ids.value().equal(torch::tensor({ 0, 0, 0, 1, 1, 1, 1, 1, 2 }, torch::TensorOptions().dtype(torch::kInt32))));
+        TESTB(ragged.max_length == 5);
+
+        auto unpacked = unpack_ragged(ragged.packed, ragged.cu_seqlens, "* d");
+        for (auto&& [output, sequence] : iters::zip(unpacked, sequences))
+            TESTB(output.equal(sequence));
+
+        CATCH(unpack_ragged(ragged.packed, std::vector<int64_t>{ 0, 3, 2, 9 }, "* d"));
+        CATCH(unpack_ragged(ragged.packed, std::vector<int64_t>{ 0, 3, 8 }, "* d"));
+    }
+
+    void test_fused_rearrange()
+    {
+        auto x = rand({ 2, 3, 4, 5 });
+        auto y = rand({ 2, 3, 6, 2 });
+        auto z = rand({ 2, 7, 3 });
+
+        // per-input patterns, the last one is already in the packed layout
+        auto&& [packed, ps] = pack(Tensors{ x, y, z }, "b * c", { "b c h w -> b (h w) c", "b c h w -> b h w c", "b n c -> b n c" });
+        auto expected = pack_t({ rearrange(x, "b c h w -> b (h w) c"), rearrange(y, "b c h w -> b h w c"), z }, "b * c");
+        TESTB(packed.equal(expected));
+        TESTS(print(ps), "{ { 20 }, { 6, 2 }, { 7 } }");
+
+        // the mirrored unpack gives back the inputs
+        auto unpacked = unpack(packed, ps, "b * c", { "b (h w) c -> b c h w", "b h2 w2 c -> b c h2 w2", "b n c -> b n c" }, axis("h", 4));
+        TESTB(unpacked[0].equal(x));
+        TESTB(unpacked[1].equal(y));
+        TESTB(unpacked[2].equal(z));
+
+        // shared pattern
+        auto&& [images, ps2] = pack(Tensors{ x, rand({ 2, 3, 2, 2 }) }, "b * c", { "b c h w -> b (h w) c" });
+        TESTS(dump(images), dump({ 2, 24, 3 }));
+
+        // inputs are copied into one output, so they need the same type
+        CATCH(pack(Tensors{}, "b * c", { "b c h w -> b (h w) c" }));
+        CATCH(pack(Tensors{ x, y.to(torch::kFloat64) }, "b * c", { "b c h w -> b (h w) c" }));
+    }
+
+    void test_fixed_arity()
+    {
+        auto x = rand({ 4, 2, 3 });
+        auto y = rand({ 4, 5 });
+        auto z = rand({ 4 });
+        auto&& [packed, ps] = pack(std::tie(x, y, z), "b *");
+        TESTS(print(packed.sizes().vec()), print(Shape{ 4, 12 }));
+        TESTB(ps.size() == 3);
+        TESTB(ps[0] == InlineShape({ 2, 3 }));
+        TESTS(print(ps[2].vec()), print(Shape{}));
+        TESTB(packed.equal(std::get<0>(pack(Tensors{ x, y, z }, "b *"))));
+
+        auto&& [x2, y2, z2] = unpack(packed, ps, "b *");
+        TESTB(x2.equal(x));
+        TESTB(y2.equal(y));
+        TESTB(z2.equal(z));
+        CATCH(unpack(packed, ps, "b * c"));
+
+        // the analysis behind pack<"b * d">(...) in C++20
+        constexpr auto analyzed = einops::implementation::_analyze_pack_pattern("b * d");
+        TESTB(analyzed.is_valid && analyzed.n_axes_before == 1 && analyzed.n_axes_after == 1);
+        for (auto pattern : { "b d", "b * * d", "b * b", "b _d *", "b  *", "" })
+            TESTB(!einops::implementation::_analyze_pack_pattern(pattern).is_valid);
+
+#if __cplusplus >= 202002L
+        // patterns given as template arguments, built by the einops_packing_test_cxx20 target
+        auto&& [checked, checked_ps] = pack<"b *">(x, y, z);
+        TESTB(checked.equal(packed));
+        TESTB(checked_ps == ps);
+        auto&& [x3, y3, z3] = unpack<"b *">(checked, checked_ps);
+        TESTB(x3.equal(x));
+        TESTB(y3.equal(y));
+        TESTB(z3.equal(z));
+#endif
+    }
+
     void test_list() final
     {
         test_trivial();
         test_pack_unpack();
+        test_pack_plan();
+        test_pack_into();
+        test_parallel();
+        test_ragged();
+        test_fused_rearrange();
+        test_fixed_arity();
     }
 };
\ No newline at end of file
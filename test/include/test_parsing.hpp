@@ -61,6 +61,10 @@ public:
 
 		for (auto&& name : vos{ "", "2b", "12", "_startWithUnderscore", "endWithUnderscore_", "_", "...",  _ellipsis })
 			TESTB(!ParsedExpression::check_axis_name(name));
+
+		// discouraged names are valid, the warnings stay with the parsed expression
+		TESTB(ParsedExpression("b axis lambda").warnings.size() == 2);
+		TESTB(ParsedExpression("b h w").warnings.empty());
 	}
 
 	void test_invalid_expressions()
@@ -4,6 +4,7 @@
 #include "test_ops.hpp"
 #include "test_parsing.hpp"
 #include "test_packing.hpp"
+#include "test_layers.hpp"
 
 int main()
 {
@@ -20,6 +21,7 @@ int main()
         out = check(out, ExamplesTest().run());
         out = check(out,      APITest().run());
         out = check(out,  PackingTest().run());
+        out = check(out,   LayersTest().run());
     }
     catch (std::exception const& e)
     {
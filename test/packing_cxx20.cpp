@@ -0,0 +1,15 @@
+#include "test_packing.hpp"
+
+// the packing suite built as C++20, for the pack<"b *">(...) overloads checked at compile time
+int main()
+{
+    try
+    {
+        return PackingTest().run();
+    }
+    catch (std::exception const& e)
+    {
+        std::cout << e.what() << std::endl;
+    }
+    return 1;
+}